@@ -1,5 +1,13 @@
 /* lua-datafilter algorithm: adler32 */
 
+#define ADLER32_BASE 65521
+
+/* The largest number of bytes which can be added up before the sums have to
+ * be reduced modulo ADLER32_BASE, without the second sum overflowing 32 bits:
+ * the largest n such that 255n(n+1)/2 + (n+1)(ADLER32_BASE-1) < 2^32.  This
+ * is the same trick zlib uses. */
+#define ADLER32_NMAX 5552
+
 typedef struct Adler32State_ {
     unsigned int s1, s2;
 } Adler32State;
@@ -15,17 +23,181 @@ algo_adler32_init (Filter *filter, int options_pos) {
     return 1;
 }
 
+static void
+adler32_update (unsigned long *s1p, unsigned long *s2p,
+                const unsigned char *in, size_t len)
+{
+    unsigned long s1 = *s1p, s2 = *s2p;
+    size_t n;
+
+    while (len) {
+        n = len < ADLER32_NMAX ? len : ADLER32_NMAX;
+        len -= n;
+        while (n--) {
+            s1 += *in++;
+            s2 += s1;
+        }
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    *s1p = s1;
+    *s2p = s2;
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* The SIMD versions add up blocks of 32 bytes at a time.  For each block,
+ * s1 goes up by the sum of the bytes, and s2 by 32 times the old s1 plus the
+ * bytes weighted 32 down to 1.  The weighted sums are done with multiply-add
+ * instructions, and the 32*s1 part is accumulated separately and multiplied
+ * in with a shift at the end of each run of blocks, when both sums are
+ * reduced.  A run is limited so that nothing can overflow, as above. */
+SIMD_TARGET("ssse3")
+static size_t
+adler32_blocks_ssse3 (unsigned long *s1p, unsigned long *s2p,
+                      const unsigned char *in, size_t len)
+{
+    const __m128i weights_hi = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+                                             24, 23, 22, 21, 20, 19, 18, 17),
+                  weights_lo = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+                                             8, 7, 6, 5, 4, 3, 2, 1),
+                  ones = _mm_set1_epi16(1),
+                  zero = _mm_setzero_si128();
+    unsigned long s1 = *s1p, s2 = *s2p;
+    size_t blocks = len / 32, n;
+    __m128i v_s1, v_s2, v_prev_s1, bytes;
+    uint32_t sums[4];
+
+    while (blocks) {
+        n = blocks < ADLER32_NMAX / 32 ? blocks : ADLER32_NMAX / 32;
+        blocks -= n;
+
+        v_prev_s1 = _mm_setr_epi32(s1 * n, 0, 0, 0);
+        v_s2 = _mm_setr_epi32(s2, 0, 0, 0);
+        v_s1 = zero;
+        do {
+            v_prev_s1 = _mm_add_epi32(v_prev_s1, v_s1);
+            bytes = _mm_loadu_si128((const __m128i *) in);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                       _mm_maddubs_epi16(bytes, weights_hi), ones));
+            bytes = _mm_loadu_si128((const __m128i *) (in + 16));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(
+                       _mm_maddubs_epi16(bytes, weights_lo), ones));
+            in += 32;
+        } while (--n);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_prev_s1, 5));
+
+        _mm_storeu_si128((__m128i *) sums, v_s1);
+        s1 += (unsigned long) sums[0] + sums[1] + sums[2] + sums[3];
+        _mm_storeu_si128((__m128i *) sums, v_s2);
+        s2 = (unsigned long) sums[0] + sums[1] + sums[2] + sums[3];
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    *s1p = s1;
+    *s2p = s2;
+    return len / 32 * 32;
+}
+
+SIMD_TARGET("avx2")
+static size_t
+adler32_blocks_avx2 (unsigned long *s1p, unsigned long *s2p,
+                     const unsigned char *in, size_t len)
+{
+    const __m256i weights = _mm256_setr_epi8(
+                      32, 31, 30, 29, 28, 27, 26, 25,
+                      24, 23, 22, 21, 20, 19, 18, 17,
+                      16, 15, 14, 13, 12, 11, 10, 9,
+                      8, 7, 6, 5, 4, 3, 2, 1),
+                  ones = _mm256_set1_epi16(1),
+                  zero = _mm256_setzero_si256();
+    unsigned long s1 = *s1p, s2 = *s2p;
+    size_t blocks = len / 32, n;
+    __m256i v_s1, v_s2, v_prev_s1, bytes;
+    uint32_t sums[8];
+
+    while (blocks) {
+        n = blocks < ADLER32_NMAX / 32 ? blocks : ADLER32_NMAX / 32;
+        blocks -= n;
+
+        v_prev_s1 = _mm256_setr_epi32(s1 * n, 0, 0, 0, 0, 0, 0, 0);
+        v_s2 = _mm256_setr_epi32(s2, 0, 0, 0, 0, 0, 0, 0);
+        v_s1 = zero;
+        do {
+            v_prev_s1 = _mm256_add_epi32(v_prev_s1, v_s1);
+            bytes = _mm256_loadu_si256((const __m256i *) in);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(
+                       _mm256_maddubs_epi16(bytes, weights), ones));
+            in += 32;
+        } while (--n);
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_prev_s1, 5));
+
+        _mm256_storeu_si256((__m256i *) sums, v_s1);
+        s1 += (unsigned long) sums[0] + sums[1] + sums[2] + sums[3] +
+              sums[4] + sums[5] + sums[6] + sums[7];
+        _mm256_storeu_si256((__m256i *) sums, v_s2);
+        s2 = (unsigned long) sums[0] + sums[1] + sums[2] + sums[3] +
+             sums[4] + sums[5] + sums[6] + sums[7];
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+
+    *s1p = s1;
+    *s2p = s2;
+    return len / 32 * 32;
+}
+#endif
+
+static size_t
+algo_adler32_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    (void) input_size;      /* unused */
+    return 4;
+}
+
+static size_t
+algo_adler32_export_state (Filter *filter, uint32_t *words) {
+    Adler32State *state = ALGO_STATE(filter);
+    words[0] = state->s1;
+    words[1] = state->s2;
+    return 2;
+}
+
+static int
+algo_adler32_import_state (Filter *filter, const uint32_t *words,
+                           size_t num_words)
+{
+    Adler32State *state = ALGO_STATE(filter);
+    if (num_words != 2 || words[0] >= ADLER32_BASE || words[1] >= ADLER32_BASE)
+        return 0;
+    state->s1 = words[0];
+    state->s2 = words[1];
+    return 1;
+}
+
 static const unsigned char *
 algo_adler32 (Filter *filter,
               const unsigned char *in, const unsigned char *in_end,
               unsigned char *out, unsigned char *out_max, int eof)
 {
     Adler32State *state = ALGO_STATE(filter);
+    unsigned long s1 = state->s1, s2 = state->s2;
 
-    while (in != in_end) {
-        state->s1 = (state->s1 + *in++) % 65521;
-        state->s2 = (state->s2 + state->s1) % 65521;
-    }
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.avx2)
+        in += adler32_blocks_avx2(&s1, &s2, in, in_end - in);
+    else if (cpu_has.ssse3)
+        in += adler32_blocks_ssse3(&s1, &s2, in, in_end - in);
+#endif
+    adler32_update(&s1, &s2, in, in_end - in);
+    in = in_end;
+
+    state->s1 = s1;
+    state->s2 = s2;
 
     if (eof) {
         if (out_max - out < 4)
@@ -115,6 +115,15 @@ algo_base64_encode_destroy (Filter *filter) {
                       state->line_ending_len, 0);
 }
 
+static void
+algo_base64_encode_clone (Filter *filter) {
+    Base64EncodeState *state = ALGO_STATE(filter);
+    Base64EncodeState *initial = ALGO_INITIAL_STATE(filter);
+    if (state->line_ending && state->line_ending != default_line_ending)
+        state->line_ending = initial->line_ending = my_strduplen(
+            filter, state->line_ending, state->line_ending_len);
+}
+
 #define DO_LINE_ENDINGS(bytes_to_go) \
     if (++state->cur_line_length == state->max_line_length \
         && state->line_ending) \
@@ -126,6 +135,178 @@ algo_base64_encode_destroy (Filter *filter) {
         state->cur_line_length = 0; \
     }
 
+#ifdef DATAFILTER_X86_SIMD
+/* The SIMD encoders work on 16 bit lanes, each pair of which holds one group
+ * of three input bytes arranged as [b1,b0,b2,b1].  That lets the four 6 bit
+ * values be shifted into place with multiplies, one per output byte.  The
+ * values are then turned into ASCII by adding an offset looked up from the
+ * range each value is in (A-Z, a-z, 0-9, + or /). */
+SIMD_TARGET("ssse3")
+static __m128i
+base64_encode_block_ssse3 (__m128i in) {
+    __m128i t0, t1, t2, t3, indices, offsets;
+
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                           4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    indices = _mm_or_si128(t1, t3);
+
+    /* 0..12 for values 51..63, then 13 for values below 26 */
+    offsets = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    offsets = _mm_or_si128(offsets,
+                           _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26),
+                                                        indices),
+                                         _mm_set1_epi8(13)));
+    offsets = _mm_shuffle_epi8(_mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4,
+                                             -4, -4, -4, -19, -16, 65, 0, 0),
+                               offsets);
+    return _mm_add_epi8(indices, offsets);
+}
+
+SIMD_TARGET("avx2")
+static __m256i
+base64_encode_block_avx2 (__m256i in) {
+    __m256i t0, t1, t2, t3, indices, offsets;
+
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+        10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+    t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+    t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    indices = _mm256_or_si256(t1, t3);
+
+    offsets = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    offsets = _mm256_or_si256(offsets,
+        _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices),
+                         _mm256_set1_epi8(13)));
+    offsets = _mm256_shuffle_epi8(_mm256_setr_epi8(
+        71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0,
+        71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 65, 0, 0),
+        offsets);
+    return _mm256_add_epi8(indices, offsets);
+}
+
+/* Each step loads 16 bytes but only uses 12, so stop while there are still
+ * at least 6 groups (18 bytes) left. */
+SIMD_TARGET("ssse3")
+static size_t
+base64_encode_groups_ssse3 (const unsigned char *in, unsigned char *out,
+                            size_t groups)
+{
+    size_t done = 0;
+
+    while (groups - done >= 6) {
+        _mm_storeu_si128((__m128i *) out, base64_encode_block_ssse3(
+            _mm_loadu_si128((const __m128i *) in)));
+        in += 12;
+        out += 16;
+        done += 4;
+    }
+
+    return done;
+}
+
+/* Each step reads 28 bytes (16 for each half, the second starting 12 bytes
+ * in), and uses 24 of them. */
+SIMD_TARGET("avx2")
+static size_t
+base64_encode_groups_avx2 (const unsigned char *in, unsigned char *out,
+                           size_t groups)
+{
+    size_t done = 0;
+    __m256i block;
+
+    while (groups - done >= 10) {
+        block = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) in)),
+            _mm_loadu_si128((const __m128i *) (in + 12)), 1);
+        _mm256_storeu_si256((__m256i *) out, base64_encode_block_avx2(block));
+        in += 24;
+        out += 32;
+        done += 8;
+    }
+
+    return done;
+}
+
+/* Encode as many whole groups of three bytes as possible with SIMD code,
+ * without going past the end of the output buffer or reaching the end of
+ * the current line, which is left to the normal code.  Returns the number
+ * of groups done, which may be zero. */
+static size_t
+base64_encode_bulk (Base64EncodeState *state,
+                    const unsigned char *in, const unsigned char *in_end,
+                    unsigned char *out, const unsigned char *out_max)
+{
+    size_t groups = (in_end - in) / 3, line_groups, done = 0;
+
+    if (!cpu_has.ssse3)
+        return 0;
+
+    if (groups > (size_t) (out_max - out) / 4)
+        groups = (out_max - out) / 4;
+    if (state->line_ending) {
+        line_groups = (state->max_line_length - state->cur_line_length - 1)
+                      / 4;
+        if (groups > line_groups)
+            groups = line_groups;
+    }
+
+    if (cpu_has.avx2)
+        done = base64_encode_groups_avx2(in, out, groups);
+    done += base64_encode_groups_ssse3(in + done * 3, out + done * 4,
+                                       groups - done);
+
+    if (state->line_ending)
+        state->cur_line_length += done * 4;
+    return done;
+}
+#endif
+
+/* Four characters for every three bytes (or part thereof, including any
+ * left over from before), plus line endings. */
+static size_t
+algo_base64_encode_size (Filter *filter, size_t input_size) {
+    Base64EncodeState *state = ALGO_STATE(filter);
+    size_t size = (input_size + 2) / 3 * 4 + 4;
+    if (state->line_ending_len > 0 && state->max_line_length > 0)
+        size += (size / state->max_line_length + 1) * state->line_ending_len;
+    return size;
+}
+
+/* Input can be split anywhere after a whole number of groups of three bytes,
+ * or when lines are being wrapped, at the end of a line, which means after
+ * enough groups to make a whole number of lines. */
+static size_t
+algo_base64_encode_chunk_align (Filter *filter) {
+    Base64EncodeState *state = ALGO_STATE(filter);
+    size_t line_chars = state->max_line_length;
+
+    if (!state->line_ending)
+        return 3;
+    while (line_chars % 4)
+        line_chars += state->max_line_length;
+    return line_chars / 4 * 3;
+}
+
+static size_t
+algo_base64_encode_chunk_size (Filter *filter, const unsigned char *in,
+                               size_t len)
+{
+    Base64EncodeState *state = ALGO_STATE(filter);
+    size_t size = len / 3 * 4;
+    (void) in;              /* unused */
+
+    if (state->line_ending)
+        size += size / state->max_line_length * state->line_ending_len;
+    return size;
+}
+
 static const unsigned char *
 algo_base64_encode (Filter *filter,
                     const unsigned char *in, const unsigned char *in_end,
@@ -133,10 +314,21 @@ algo_base64_encode (Filter *filter,
 {
     Base64EncodeState *state = ALGO_STATE(filter);
     unsigned int n;
+#ifdef DATAFILTER_X86_SIMD
+    size_t groups;
+#endif
 
     while (in_end - in >= 3) {
         if (out_max - out < 4)
             out = filter->do_output(filter, out, &out_max);
+#ifdef DATAFILTER_X86_SIMD
+        groups = base64_encode_bulk(state, in, in_end, out, out_max);
+        if (groups) {
+            in += groups * 3;
+            out += groups * 4;
+            continue;
+        }
+#endif
         n = (in[0] << 16) | (in[1] << 8) | in[2];
         in += 3;
         *out++ = base64_char_code[n >> 18];
@@ -259,10 +451,194 @@ do_base64_decode_block (Filter *filter, Base64DecodeState *state,
     return out;
 }
 
-/* Define this myself so that it's not locale dependent.  Also it doesn't
- * allow vertical tabs as whitespace, because nobody uses them. */
-#define my_isspace(c) ((c) == 32 || (c) == 10 || (c) == 13 || (c) == 9 || \
-                       (c) == 12)
+#ifdef DATAFILTER_X86_SIMD
+/* Translate 16 characters of Base64 into their 6 bit values, and pack them
+ * into the first 12 bytes of the result.  Returns false, without doing
+ * anything, if any of the characters aren't in the Base64 alphabet (which
+ * includes padding and whitespace).  The characters are checked by using
+ * the low nibble of each to look up a bitmask of which high nibbles are
+ * valid with it, and translated by adding an offset looked up from the high
+ * nibble, with a special case for '/', which shares its high nibble with
+ * '+' but needs a different offset. */
+SIMD_TARGET("ssse3")
+static int
+base64_decode_block_ssse3 (__m128i in, __m128i *result) {
+    const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibble_mask),
+            lo_nibbles = _mm_and_si128(in, nibble_mask),
+            valid_hi, hi_bit, offsets, values;
+
+    valid_hi = _mm_shuffle_epi8(_mm_setr_epi8(
+        (char) 0xA8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF0, 0x54,
+        0x50, 0x50, 0x50, 0x54), lo_nibbles);
+    hi_bit = _mm_shuffle_epi8(_mm_setr_epi8(
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+        0, 0, 0, 0, 0, 0, 0, 0), hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(valid_hi, hi_bit),
+                                         _mm_setzero_si128())))
+        return 0;
+
+    offsets = _mm_shuffle_epi8(_mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+                                             0, 0, 0, 0, 0, 0, 0, 0),
+                               hi_nibbles);
+    offsets = _mm_add_epi8(offsets,
+                           _mm_and_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(47)),
+                                         _mm_set1_epi8(-3)));
+    values = _mm_add_epi8(in, offsets);
+
+    /* Merge pairs of values into 12 bit numbers, then pairs of those into
+     * 24 bits, and finally put the bytes in the right order. */
+    values = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    values = _mm_madd_epi16(values, _mm_set1_epi32(0x00011000));
+    *result = _mm_shuffle_epi8(values, _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+                                                     10, 9, 8, 14, 13, 12,
+                                                     -1, -1, -1, -1));
+    return 1;
+}
+
+/* The same as above, but for 32 characters, packed into 24 bytes. */
+SIMD_TARGET("avx2")
+static int
+base64_decode_block_avx2 (__m256i in, __m256i *result) {
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+                                          nibble_mask),
+            lo_nibbles = _mm256_and_si256(in, nibble_mask),
+            valid_hi, hi_bit, offsets, values;
+
+    valid_hi = _mm256_shuffle_epi8(_mm256_setr_epi8(
+        (char) 0xA8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF0, 0x54,
+        0x50, 0x50, 0x50, 0x54,
+        (char) 0xA8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF8, (char) 0xF8,
+        (char) 0xF8, (char) 0xF8, (char) 0xF0, 0x54,
+        0x50, 0x50, 0x50, 0x54), lo_nibbles);
+    hi_bit = _mm256_shuffle_epi8(_mm256_setr_epi8(
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+        0, 0, 0, 0, 0, 0, 0, 0), hi_nibbles);
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_and_si256(valid_hi, hi_bit), _mm256_setzero_si256())))
+        return 0;
+
+    offsets = _mm256_shuffle_epi8(_mm256_setr_epi8(
+        0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0),
+        hi_nibbles);
+    offsets = _mm256_add_epi8(offsets, _mm256_and_si256(
+        _mm256_cmpeq_epi8(in, _mm256_set1_epi8(47)), _mm256_set1_epi8(-3)));
+    values = _mm256_add_epi8(in, offsets);
+
+    values = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    values = _mm256_madd_epi16(values, _mm256_set1_epi32(0x00011000));
+    values = _mm256_shuffle_epi8(values, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    *result = _mm256_permutevar8x32_epi32(values,
+                                          _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                            3, 7));
+    return 1;
+}
+
+/* Each step stores 16 bytes of output but only advances by 12. */
+SIMD_TARGET("ssse3")
+static size_t
+base64_decode_chars_ssse3 (const unsigned char *in, size_t in_len,
+                           unsigned char *out, size_t out_space)
+{
+    size_t done = 0;
+    __m128i block;
+
+    while (in_len - done >= 16 && out_space >= 16) {
+        if (!base64_decode_block_ssse3(
+                _mm_loadu_si128((const __m128i *) (in + done)), &block))
+            break;
+        _mm_storeu_si128((__m128i *) out, block);
+        done += 16;
+        out += 12;
+        out_space -= 12;
+    }
+
+    return done;
+}
+
+/* Each step stores 32 bytes of output but only advances by 24. */
+SIMD_TARGET("avx2")
+static size_t
+base64_decode_chars_avx2 (const unsigned char *in, size_t in_len,
+                          unsigned char *out, size_t out_space)
+{
+    size_t done = 0;
+    __m256i block;
+
+    while (in_len - done >= 32 && out_space >= 32) {
+        if (!base64_decode_block_avx2(
+                _mm256_loadu_si256((const __m256i *) (in + done)), &block))
+            break;
+        _mm256_storeu_si256((__m256i *) out, block);
+        done += 32;
+        out += 24;
+        out_space -= 24;
+    }
+
+    return done;
+}
+
+/* Decode as many characters as possible with SIMD code, which only works
+ * on blocks which consist entirely of characters from the Base64 alphabet.
+ * Anything else, including padding, whitespace and errors, stops it so that
+ * it can be dealt with one character at a time.  Should only be called at
+ * the start of a block of four characters.  Returns the number of input
+ * characters used, which will be a multiple of 16, and may be zero. */
+static size_t
+base64_decode_bulk (const unsigned char *in, const unsigned char *in_end,
+                    unsigned char *out, const unsigned char *out_max)
+{
+    size_t in_len = in_end - in, out_space = out_max - out, done = 0;
+
+    if (!cpu_has.ssse3)
+        return 0;
+
+    if (cpu_has.avx2)
+        done = base64_decode_chars_avx2(in, in_len, out, out_space);
+    return done + base64_decode_chars_ssse3(in + done, in_len - done,
+                                            out + done / 4 * 3,
+                                            out_space - done / 4 * 3);
+}
+#endif
+
+static size_t
+algo_base64_decode_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size / 4 * 3 + 3;
+}
+
+/* Only input consisting entirely of whole groups of four characters from
+ * the Base64 alphabet can be split up, so anything with whitespace or
+ * padding in it has to be done the normal way. */
+static size_t
+algo_base64_decode_chunk_align (Filter *filter) {
+    (void) filter;          /* unused */
+    return 4;
+}
+
+static size_t
+algo_base64_decode_chunk_size (Filter *filter, const unsigned char *in,
+                               size_t len)
+{
+    const unsigned char *in_end = in + len;
+    unsigned char bad = 0;
+    (void) filter;          /* unused */
+
+    for (; in != in_end; ++in)
+        bad |= base64_char_value[*in] & 0xC0;
+    return bad ? (size_t) -1 : len / 4 * 3;
+}
 
 static const unsigned char *
 algo_base64_decode (Filter *filter,
@@ -272,8 +648,20 @@ algo_base64_decode (Filter *filter,
     Base64DecodeState *state = ALGO_STATE(filter);
     unsigned char *n = state->n;
     unsigned char byte, c;
+#ifdef DATAFILTER_X86_SIMD
+    size_t chars;
+#endif
 
     while (in != in_end) {
+#ifdef DATAFILTER_X86_SIMD
+        if (state->count == 0 && !state->seen_end) {
+            chars = base64_decode_bulk(in, in_end, out, out_max);
+            in += chars;
+            out += chars / 4 * 3;
+            if (in == in_end)
+                break;
+        }
+#endif
         byte = *in++;
         c = base64_char_value[byte];
         if (c > 64) {
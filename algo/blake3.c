@@ -0,0 +1,630 @@
+/* lua-datafilter algorithm: blake3
+ */
+
+#include <stdint.h>
+
+/* The input is split into chunks, which are hashed a block at a time, and
+ * the chaining values of the chunks are combined in a binary tree of
+ * parent nodes.  The last node hashed (the root) also produces the output,
+ * as much as is wanted. */
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_CHUNK_BLOCKS (BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN)
+#define BLAKE3_CV_LEN 32
+
+/* Enough levels of the tree for 2^64 bytes of input. */
+#define BLAKE3_MAX_DEPTH 54
+
+/* Limits on the 'length' option, for the amount of output. */
+#define BLAKE3_DEFAULT_LENGTH 32
+#define BLAKE3_MAX_LENGTH (256 * 1024 * 1024)
+
+/* Subtrees of up to this many chunks are hashed in one go, with their
+ * chaining values kept on the C stack.  Bigger ones are split in half. */
+#define BLAKE3_BATCH_CHUNKS 64
+
+#define BLAKE3_CHUNK_START 1
+#define BLAKE3_CHUNK_END 2
+#define BLAKE3_PARENT 4
+#define BLAKE3_ROOT 8
+
+#define rotr(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t
+blake3_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+/* Which message words are used in each of the seven rounds. */
+static const unsigned char
+blake3_schedule[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static void
+blake3_bytestowords (const unsigned char *input, uint32_t *output,
+                     int num_words)
+{
+    for (; num_words > 0; --num_words, input += 4)
+        *output++ = (uint32_t) input[0] | ((uint32_t) input[1] << 8) |
+                    ((uint32_t) input[2] << 16) | ((uint32_t) input[3] << 24);
+}
+
+static void
+blake3_wordstobytes (const uint32_t *input, unsigned char *output,
+                     int num_words)
+{
+    uint32_t v;
+    for (; num_words > 0; --num_words, output += 4) {
+        v = *input++;
+        output[0] = v & 0xFF;
+        output[1] = (v >> 8) & 0xFF;
+        output[2] = (v >> 16) & 0xFF;
+        output[3] = v >> 24;
+    }
+}
+
+#define BLAKE3_G(a, b, c, d, x, y) \
+    a += b + (x);  d = rotr(d ^ a, 16);  c += d;  b = rotr(b ^ c, 12); \
+    a += b + (y);  d = rotr(d ^ a, 8);  c += d;  b = rotr(b ^ c, 7);
+
+/* Compress one block, putting all 16 words of output in 'out'.  The first
+ * eight are the new chaining value.  The block is read before anything is
+ * written, so 'out' can overlap it. */
+static void
+blake3_compress (const uint32_t *cv, const unsigned char *block,
+                 unsigned int block_len, uint64_t counter,
+                 unsigned int flags, uint32_t *out)
+{
+    uint32_t m[16], v[16];
+    const unsigned char *s;
+    int i, r;
+
+    blake3_bytestowords(block, m, 16);
+    for (i = 0; i < 8; ++i)
+        v[i] = cv[i];
+    for (i = 0; i < 4; ++i)
+        v[i + 8] = blake3_iv[i];
+    v[12] = (uint32_t) counter;
+    v[13] = (uint32_t) (counter >> 32);
+    v[14] = block_len;
+    v[15] = flags;
+
+    for (r = 0; r < 7; ++r) {
+        s = blake3_schedule[r];
+        BLAKE3_G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]])
+        BLAKE3_G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]])
+        BLAKE3_G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]])
+        BLAKE3_G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]])
+        BLAKE3_G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]])
+        BLAKE3_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]])
+        BLAKE3_G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]])
+        BLAKE3_G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]])
+    }
+
+    for (i = 0; i < 8; ++i) {
+        out[i + 8] = v[i + 8] ^ cv[i];
+        out[i] = v[i] ^ v[i + 8];
+    }
+}
+
+#undef BLAKE3_G
+
+/* Hash whole chunks (or parent nodes, two chaining values joined together,
+ * if 'parents' is true), each of which starts at one of 'inputs', writing
+ * the chaining value for each to 'out'.  Chunk counters go up by one from
+ * 'counter'.  As with blake3_compress(), the output can overlap the input
+ * as long as it doesn't get ahead of it. */
+static void
+blake3_hash_inputs (const unsigned char *const *inputs, size_t num_inputs,
+                    uint64_t counter, int parents, unsigned char *out)
+{
+    uint32_t h[16];
+    size_t b, blocks = parents ? 1 : BLAKE3_CHUNK_BLOCKS;
+    unsigned int flags;
+
+    for (; num_inputs > 0; --num_inputs, ++inputs, out += BLAKE3_CV_LEN) {
+        memcpy(h, blake3_iv, sizeof(blake3_iv));
+        for (b = 0; b < blocks; ++b) {
+            if (parents)
+                flags = BLAKE3_PARENT;
+            else
+                flags = (b == 0 ? BLAKE3_CHUNK_START : 0) |
+                        (b == blocks - 1 ? BLAKE3_CHUNK_END : 0);
+            blake3_compress(h, *inputs + b * BLAKE3_BLOCK_LEN,
+                            BLAKE3_BLOCK_LEN, parents ? 0 : counter, flags, h);
+        }
+        blake3_wordstobytes(h, out, 8);
+        if (!parents)
+            ++counter;
+    }
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* The same as blake3_hash_inputs(), but with several inputs at once, one
+ * in each 32 bit lane of the vectors.  The message words are loaded with
+ * the transposing functions used for the multi-buffer hashes, which give
+ * them in little endian order as needed here.  The V* operations are
+ * defined below for each instruction set. */
+#define BLAKE3X_G(a, b, c, d, x, y) \
+    a = VADD(VADD(a, b), x);  d = VROTR16(VXOR(d, a)); \
+    c = VADD(c, d);  b = VROTR(VXOR(b, c), 12); \
+    a = VADD(VADD(a, b), y);  d = VROTR8(VXOR(d, a)); \
+    c = VADD(c, d);  b = VROTR(VXOR(b, c), 7);
+#define BLAKE3X_ROUND(r) \
+        s = blake3_schedule[r]; \
+        BLAKE3X_G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]) \
+        BLAKE3X_G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]) \
+        BLAKE3X_G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]) \
+        BLAKE3X_G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]) \
+        BLAKE3X_G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]) \
+        BLAKE3X_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]) \
+        BLAKE3X_G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]) \
+        BLAKE3X_G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]])
+#define BLAKE3X_ROUNDS \
+    BLAKE3X_ROUND(0)  BLAKE3X_ROUND(1)  BLAKE3X_ROUND(2)  BLAKE3X_ROUND(3) \
+    BLAKE3X_ROUND(4)  BLAKE3X_ROUND(5)  BLAKE3X_ROUND(6)
+#define BLAKE3X_HASH_INPUTS(lanes, load_func) \
+    uint32_t counter_low[lanes], counter_high[lanes], words[8][lanes]; \
+    const unsigned char *blocks[lanes]; \
+    size_t b, num_blocks = parents ? 1 : BLAKE3_CHUNK_BLOCKS; \
+    unsigned int flags; \
+    const unsigned char *s; \
+    int i, r; \
+    for (i = 0; i < lanes; ++i) { \
+        counter_low[i] = parents ? 0 : (uint32_t) (counter + i); \
+        counter_high[i] = parents ? 0 : (uint32_t) ((counter + i) >> 32); \
+    } \
+    for (i = 0; i < 8; ++i) \
+        h[i] = VSET1(blake3_iv[i]); \
+    for (b = 0; b < num_blocks; ++b) { \
+        for (i = 0; i < lanes; ++i) \
+            blocks[i] = inputs[i] + b * BLAKE3_BLOCK_LEN; \
+        load_func(m, blocks); \
+        if (parents) \
+            flags = BLAKE3_PARENT; \
+        else \
+            flags = (b == 0 ? BLAKE3_CHUNK_START : 0) | \
+                    (b == num_blocks - 1 ? BLAKE3_CHUNK_END : 0); \
+        for (i = 0; i < 8; ++i) \
+            v[i] = h[i]; \
+        for (i = 0; i < 4; ++i) \
+            v[i + 8] = VSET1(blake3_iv[i]); \
+        v[12] = VLOAD(counter_low); \
+        v[13] = VLOAD(counter_high); \
+        v[14] = VSET1(BLAKE3_BLOCK_LEN); \
+        v[15] = VSET1(flags); \
+        BLAKE3X_ROUNDS \
+        for (i = 0; i < 8; ++i) \
+            h[i] = VXOR(v[i], v[i + 8]); \
+    } \
+    for (i = 0; i < 8; ++i) \
+        VSTORE(words[i], h[i]); \
+    for (r = 0; r < lanes; ++r, out += BLAKE3_CV_LEN) \
+        for (i = 0; i < 8; ++i) \
+            blake3_wordstobytes(&words[i][r], out + 4 * i, 1);
+
+#define VADD _mm_add_epi32
+#define VXOR _mm_xor_si128
+#define VSET1 _mm_set1_epi32
+#define VLOAD(p) _mm_loadu_si128((const __m128i *) (p))
+#define VSTORE(p, x) _mm_storeu_si128((__m128i *) (p), x)
+#define VROTR(x, n) \
+    _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define VROTR16(x) \
+    _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xB1), 0xB1)
+#define VROTR8(x) VROTR(x, 8)
+
+SIMD_TARGET("sse2")
+static void
+blake3_hash_x4_sse2 (const unsigned char *const *inputs, uint64_t counter,
+                     int parents, unsigned char *out)
+{
+    __m128i h[8], v[16], m[16];
+    BLAKE3X_HASH_INPUTS(4, multibuf_load_x4_sse2)
+}
+
+#undef VADD
+#undef VXOR
+#undef VSET1
+#undef VLOAD
+#undef VSTORE
+#undef VROTR
+#undef VROTR16
+#undef VROTR8
+#define VADD _mm256_add_epi32
+#define VXOR _mm256_xor_si256
+#define VSET1 _mm256_set1_epi32
+#define VLOAD(p) _mm256_loadu_si256((const __m256i *) (p))
+#define VSTORE(p, x) _mm256_storeu_si256((__m256i *) (p), x)
+#define VROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define VROTR16(x) _mm256_shuffle_epi8(x, rotr16)
+#define VROTR8(x) _mm256_shuffle_epi8(x, rotr8)
+
+SIMD_TARGET("avx2")
+static void
+blake3_hash_x8_avx2 (const unsigned char *const *inputs, uint64_t counter,
+                     int parents, unsigned char *out)
+{
+    /* Rotations by whole bytes can be done with byte shuffles. */
+    const __m256i rotr16 = _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rotr8 = _mm256_setr_epi8(
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+        1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    __m256i h[8], v[16], m[16];
+    BLAKE3X_HASH_INPUTS(8, multibuf_load_x8_avx2)
+}
+
+#undef VADD
+#undef VXOR
+#undef VSET1
+#undef VLOAD
+#undef VSTORE
+#undef VROTR
+#undef VROTR16
+#undef VROTR8
+#undef BLAKE3X_HASH_INPUTS
+#undef BLAKE3X_ROUNDS
+#undef BLAKE3X_ROUND
+#undef BLAKE3X_G
+#endif
+
+/* Hash as many inputs as possible with SIMD, and the rest one at a time. */
+static void
+blake3_hash_many (const unsigned char *const *inputs, size_t num_inputs,
+                  uint64_t counter, int parents, unsigned char *out)
+{
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.avx2) {
+        for (; num_inputs >= 8; num_inputs -= 8, inputs += 8) {
+            blake3_hash_x8_avx2(inputs, counter, parents, out);
+            counter += 8;
+            out += 8 * BLAKE3_CV_LEN;
+        }
+    }
+    if (cpu_has.sse2) {
+        for (; num_inputs >= 4; num_inputs -= 4, inputs += 4) {
+            blake3_hash_x4_sse2(inputs, counter, parents, out);
+            counter += 4;
+            out += 4 * BLAKE3_CV_LEN;
+        }
+    }
+#endif
+    blake3_hash_inputs(inputs, num_inputs, counter, parents, out);
+}
+
+/* Combine a power of two number of chaining values, stored one after the
+ * other, into the chaining value at the root of their subtree, which ends
+ * up at the start of the array. */
+static void
+blake3_reduce (unsigned char *cvs, size_t num_cvs) {
+    const unsigned char *inputs[BLAKE3_BATCH_CHUNKS / 2];
+    size_t i, n;
+
+    while (num_cvs > 1) {
+        num_cvs /= 2;
+        for (i = 0; i < num_cvs; i += n) {
+            for (n = 0; n < num_cvs - i && n < BLAKE3_BATCH_CHUNKS / 2; ++n)
+                inputs[n] = cvs + (i + n) * 2 * BLAKE3_CV_LEN;
+            blake3_hash_many(inputs, n, 0, 1, cvs + i * BLAKE3_CV_LEN);
+        }
+    }
+}
+
+/* Find the chaining value for a complete subtree of 'num_chunks' chunks,
+ * which must be a power of two, and which isn't the whole tree. */
+static void
+blake3_subtree (const unsigned char *in, size_t num_chunks, uint64_t counter,
+                unsigned char *cv_out)
+{
+    unsigned char cvs[BLAKE3_BATCH_CHUNKS * BLAKE3_CV_LEN];
+    const unsigned char *inputs[BLAKE3_BATCH_CHUNKS];
+    size_t i, half;
+
+    if (num_chunks > BLAKE3_BATCH_CHUNKS) {
+        half = num_chunks / 2;
+        blake3_subtree(in, half, counter, cvs);
+        blake3_subtree(in + half * BLAKE3_CHUNK_LEN, half, counter + half,
+                       cvs + BLAKE3_CV_LEN);
+        blake3_reduce(cvs, 2);
+    }
+    else {
+        for (i = 0; i < num_chunks; ++i)
+            inputs[i] = in + i * BLAKE3_CHUNK_LEN;
+        blake3_hash_many(inputs, num_chunks, counter, 0, cvs);
+        blake3_reduce(cvs, num_chunks);
+    }
+
+    memcpy(cv_out, cvs, BLAKE3_CV_LEN);
+}
+
+#ifdef DATAFILTER_THREADS
+typedef struct Blake3Subtree_ {
+    const unsigned char *in;
+    size_t num_chunks;
+    uint64_t counter;
+    unsigned char *cv_out;
+} Blake3Subtree;
+
+static void *
+blake3_subtree_thread (void *arg) {
+    Blake3Subtree *subtree = arg;
+    blake3_subtree(subtree->in, subtree->num_chunks, subtree->counter,
+                   subtree->cv_out);
+    return 0;
+}
+#endif
+
+/* The same as blake3_subtree(), but if the subtree is big enough it's
+ * split into equal parts, a power of two of them, and up to 'threads' of
+ * those are done at the same time.  If a thread can't be started then its
+ * part is done in this thread. */
+static void
+blake3_subtree_threads (const unsigned char *in, size_t num_chunks,
+                        uint64_t counter, int threads, unsigned char *cv_out)
+{
+#ifdef DATAFILTER_THREADS
+    Blake3Subtree parts[FILTER_MAX_THREADS];
+    pthread_t thread_ids[FILTER_MAX_THREADS];
+    unsigned char cvs[FILTER_MAX_THREADS * BLAKE3_CV_LEN];
+    size_t part_chunks;
+    int num_parts = 1, started, i;
+
+    while (num_parts * 2 <= threads &&
+           num_chunks / (num_parts * 2) * BLAKE3_CHUNK_LEN >=
+               FILTER_THREAD_MIN_INPUT)
+        num_parts *= 2;
+
+    if (num_parts > 1) {
+        part_chunks = num_chunks / num_parts;
+        for (i = 0; i < num_parts; ++i) {
+            parts[i].in = in + i * part_chunks * BLAKE3_CHUNK_LEN;
+            parts[i].num_chunks = part_chunks;
+            parts[i].counter = counter + i * part_chunks;
+            parts[i].cv_out = cvs + i * BLAKE3_CV_LEN;
+        }
+        for (started = 1; started < num_parts; ++started) {
+            if (pthread_create(&thread_ids[started], 0, blake3_subtree_thread,
+                               &parts[started]))
+                break;
+        }
+        for (i = started; i < num_parts; ++i)
+            blake3_subtree_thread(&parts[i]);
+        blake3_subtree_thread(&parts[0]);
+        for (i = 1; i < started; ++i)
+            pthread_join(thread_ids[i], 0);
+
+        blake3_reduce(cvs, num_parts);
+        memcpy(cv_out, cvs, BLAKE3_CV_LEN);
+        return;
+    }
+#else
+    (void) threads;     /* unused */
+#endif
+
+    blake3_subtree(in, num_chunks, counter, cv_out);
+}
+
+typedef struct Blake3State_ {
+    uint32_t cv[8];         /* for the chunk currently being hashed */
+    uint64_t chunk_counter;
+    unsigned int blocks_done;
+    /* Chaining values for the subtrees to the left of the current chunk,
+     * biggest first.  They're combined only when it's certain that there
+     * will be more input after them, since the root is treated
+     * differently. */
+    unsigned char stack[BLAKE3_MAX_DEPTH][BLAKE3_CV_LEN];
+    unsigned int stack_len;
+    size_t out_len;
+    int threads;
+} Blake3State;
+
+static int
+algo_blake3_init (Filter *filter, int options_pos) {
+    Blake3State *state = ALGO_STATE(filter);
+    lua_State *L = filter->L;
+    lua_Number n;
+
+    memcpy(state->cv, blake3_iv, sizeof(blake3_iv));
+    state->chunk_counter = 0;
+    state->blocks_done = 0;
+    state->stack_len = 0;
+    state->out_len = BLAKE3_DEFAULT_LENGTH;
+    state->threads = 1;
+
+    if (options_pos) {
+        lua_getfield(L, options_pos, "length");
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isnumber(L, -1))
+                ALGO_ERROR("bad value for 'length' option, should be a"
+                           " number");
+            n = lua_tonumber(L, -1);
+            if (!(n >= 1 && n <= BLAKE3_MAX_LENGTH)) {
+                lua_pushfstring(L, "bad value for 'length' option, must be"
+                                " between 1 and %d", BLAKE3_MAX_LENGTH);
+                return 0;
+            }
+            state->out_len = n;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, options_pos, "threads");
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isnumber(L, -1))
+                ALGO_ERROR("bad value for 'threads' option, should be a"
+                           " number");
+            n = lua_tonumber(L, -1);
+            if (!(n >= 1 && n <= FILTER_MAX_THREADS)) {
+                lua_pushfstring(L, "bad value for 'threads' option, must be"
+                                " between 1 and %d", FILTER_MAX_THREADS);
+                return 0;
+            }
+            state->threads = n;
+        }
+        lua_pop(L, 1);
+    }
+
+    return 1;
+}
+
+static size_t
+algo_blake3_size (Filter *filter, size_t input_size) {
+    Blake3State *state = ALGO_STATE(filter);
+    (void) input_size;      /* unused */
+    return state->out_len;
+}
+
+static unsigned int
+blake3_popcount (uint64_t n) {
+    unsigned int count = 0;
+    for (; n; n &= n - 1)
+        ++count;
+    return count;
+}
+
+/* Merge the subtrees on the stack as far as possible, given that there
+ * are 'counter' chunks in them altogether, leaving one for each bit set. */
+static void
+blake3_merge_stack (Blake3State *state, uint64_t counter) {
+    unsigned int post_merge_len = blake3_popcount(counter);
+
+    while (state->stack_len > post_merge_len) {
+        blake3_reduce(state->stack[state->stack_len - 2], 2);
+        --state->stack_len;
+    }
+}
+
+/* Add the chaining value of a subtree which starts at chunk 'counter'. */
+static void
+blake3_push_cv (Blake3State *state, const unsigned char *cv,
+                uint64_t counter)
+{
+    blake3_merge_stack(state, counter);
+    memcpy(state->stack[state->stack_len++], cv, BLAKE3_CV_LEN);
+}
+
+/* Write the root's output, which is produced a block at a time from the
+ * same input with the counter going up. */
+static void
+blake3_output (Filter *filter, const uint32_t *cv,
+               const unsigned char *block, unsigned int block_len,
+               unsigned int flags, unsigned char *out, unsigned char *out_max)
+{
+    Blake3State *state = ALGO_STATE(filter);
+    size_t left = state->out_len, n;
+    uint64_t counter;
+    uint32_t words[16];
+
+    for (counter = 0; left > 0; ++counter, left -= n) {
+        blake3_compress(cv, block, block_len, counter, flags | BLAKE3_ROOT,
+                        words);
+        n = left < BLAKE3_BLOCK_LEN ? left : BLAKE3_BLOCK_LEN;
+        if ((size_t) (out_max - out) < BLAKE3_BLOCK_LEN)
+            out = filter->do_output(filter, out, &out_max);
+        if (n == BLAKE3_BLOCK_LEN)
+            blake3_wordstobytes(words, out, 16);
+        else {
+            unsigned char buff[BLAKE3_BLOCK_LEN];
+            blake3_wordstobytes(words, buff, 16);
+            memcpy(out, buff, n);
+        }
+        out += n;
+    }
+
+    filter->buf_out_end = out;
+}
+
+static const unsigned char *
+algo_blake3 (Filter *filter,
+             const unsigned char *in, const unsigned char *in_end,
+             unsigned char *out, unsigned char *out_max, int eof)
+{
+    Blake3State *state = ALGO_STATE(filter);
+    unsigned char cv_bytes[BLAKE3_CV_LEN], block[BLAKE3_BLOCK_LEN];
+    uint32_t cv[8], words[16];
+    size_t num_chunks, n;
+    uint64_t counter;
+    unsigned int block_len, flags, i;
+
+    /* Nothing is done with the last byte of input until the end, because
+     * the last block has to be treated differently. */
+    for (;;) {
+        if (state->blocks_done == 0 &&
+            (size_t) (in_end - in) > BLAKE3_CHUNK_LEN)
+        {
+            /* Whole chunks are done in the biggest subtrees possible, which
+             * have to line up with the number of chunks done so far. */
+            num_chunks = (in_end - in - 1) / BLAKE3_CHUNK_LEN;
+            for (n = 1; n * 2 <= num_chunks; n *= 2)
+                ;
+            while (state->chunk_counter & (n - 1))
+                n /= 2;
+            blake3_subtree_threads(in, n, state->chunk_counter,
+                                   state->threads, cv_bytes);
+            blake3_push_cv(state, cv_bytes, state->chunk_counter);
+            state->chunk_counter += n;
+            in += n * BLAKE3_CHUNK_LEN;
+            continue;
+        }
+
+        if ((size_t) (in_end - in) <= BLAKE3_BLOCK_LEN)
+            break;
+
+        flags = (state->blocks_done == 0 ? BLAKE3_CHUNK_START : 0) |
+                (state->blocks_done == BLAKE3_CHUNK_BLOCKS - 1 ?
+                 BLAKE3_CHUNK_END : 0);
+        blake3_compress(state->cv, in, BLAKE3_BLOCK_LEN, state->chunk_counter,
+                        flags, words);
+        memcpy(state->cv, words, sizeof(state->cv));
+        in += BLAKE3_BLOCK_LEN;
+
+        if (++state->blocks_done == BLAKE3_CHUNK_BLOCKS) {
+            blake3_wordstobytes(state->cv, cv_bytes, 8);
+            blake3_push_cv(state, cv_bytes, state->chunk_counter);
+            ++state->chunk_counter;
+            state->blocks_done = 0;
+            memcpy(state->cv, blake3_iv, sizeof(blake3_iv));
+        }
+    }
+
+    if (eof) {
+        /* The last block of the last chunk, padded with zeros, is hashed
+         * and then combined with the subtrees on the stack, from the
+         * smallest up, leaving the root node still to be hashed. */
+        blake3_merge_stack(state, state->chunk_counter);
+        block_len = in_end - in;
+        memcpy(block, in, block_len);
+        memset(block + block_len, 0, BLAKE3_BLOCK_LEN - block_len);
+        in = in_end;
+        memcpy(cv, state->cv, sizeof(cv));
+        counter = state->chunk_counter;
+        flags = BLAKE3_CHUNK_END |
+                (state->blocks_done == 0 ? BLAKE3_CHUNK_START : 0);
+
+        for (i = state->stack_len; i > 0; --i) {
+            blake3_compress(cv, block, block_len, counter, flags, words);
+            memcpy(block, state->stack[i - 1], BLAKE3_CV_LEN);
+            blake3_wordstobytes(words, block + BLAKE3_CV_LEN, 8);
+            block_len = BLAKE3_BLOCK_LEN;
+            memcpy(cv, blake3_iv, sizeof(blake3_iv));
+            counter = 0;
+            flags = BLAKE3_PARENT;
+        }
+
+        blake3_output(filter, cv, block, block_len, flags, out, out_max);
+    }
+
+    return in;
+}
+
+#undef rotr
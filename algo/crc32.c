@@ -0,0 +1,273 @@
+/* lua-datafilter algorithms: crc32, crc32c
+ */
+
+#include <stdint.h>
+
+/* The polynomials, bit reversed, since both CRCs work on the least
+ * significant bit of each byte first.  CRC-32 is the one used by zlib, gzip
+ * and PNG, and CRC-32C (Castagnoli) is the one used by iSCSI and ext4. */
+#define CRC32_POLY  0xEDB88320
+#define CRC32C_POLY 0x82F63B78
+
+/* Lookup tables for processing eight bytes at a time.  The first table is
+ * the usual one for a byte at a time, and each table after that gives the
+ * effect of a byte followed by one more zero byte than the last.  They're
+ * filled in by crc32_make_tables() when the module is loaded. */
+static uint32_t crc32_table[8][256], crc32c_table[8][256];
+
+static void
+crc32_fill_table (uint32_t (*table)[256], uint32_t poly) {
+    uint32_t c;
+    int n, k;
+
+    for (n = 0; n < 256; ++n) {
+        c = n;
+        for (k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ poly : c >> 1;
+        table[0][n] = c;
+    }
+    for (n = 0; n < 256; ++n) {
+        c = table[0][n];
+        for (k = 1; k < 8; ++k) {
+            c = (c >> 8) ^ table[0][c & 0xFF];
+            table[k][n] = c;
+        }
+    }
+}
+
+static void
+crc32_make_tables (void) {
+    crc32_fill_table(crc32_table, CRC32_POLY);
+    crc32_fill_table(crc32c_table, CRC32C_POLY);
+}
+
+typedef struct CRC32State_ {
+    uint32_t crc;       /* not yet inverted at the end */
+} CRC32State;
+
+static int
+algo_crc32_init (Filter *filter, int options_pos) {
+    CRC32State *state = ALGO_STATE(filter);
+    (void) options_pos;     /* unused */
+
+    state->crc = 0xFFFFFFFF;
+    return 1;
+}
+
+static int
+algo_crc32c_init (Filter *filter, int options_pos) {
+    return algo_crc32_init(filter, options_pos);
+}
+
+static uint32_t
+crc32_update (uint32_t (*table)[256], uint32_t crc,
+              const unsigned char *in, size_t len)
+{
+    /* Slicing by eight.  The bytes are put together by hand so that this
+     * doesn't depend on the byte order of the machine. */
+    while (len >= 8) {
+        crc ^= (uint32_t) in[0] | ((uint32_t) in[1] << 8) |
+               ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+        crc = table[7][crc & 0xFF] ^ table[6][(crc >> 8) & 0xFF] ^
+              table[5][(crc >> 16) & 0xFF] ^ table[4][crc >> 24] ^
+              table[3][in[4]] ^ table[2][in[5]] ^
+              table[1][in[6]] ^ table[0][in[7]];
+        in += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc = (crc >> 8) ^ table[0][(crc ^ *in++) & 0xFF];
+
+    return crc;
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* CRC-32 by folding with carry-less multiplication, as described in Intel's
+ * paper "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction".  Four 128 bit accumulators are folded forward over 64 bytes
+ * at a time, then folded into one, and finally reduced to 32 bits with
+ * Barrett reduction.  The constants are powers of x modulo the polynomial,
+ * bit reflected, from the end of the paper.  This does a multiple of 16
+ * bytes, at least 64, and returns how many. */
+SIMD_TARGET("pclmul,sse4.1")
+static size_t
+crc32_blocks_pclmul (uint32_t *crcp, const unsigned char *in, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL),
+                  k3k4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL),
+                  k5 = _mm_set_epi64x(0, 0x0163CD6124LL),
+                  poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL),
+                  mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+    size_t done = len / 16 * 16, n = done;
+    __m128i x0, x1, x2, x3, x4, x5;
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) in),
+                       _mm_cvtsi32_si128((int) *crcp));
+    x1 = _mm_loadu_si128((const __m128i *) (in + 16));
+    x2 = _mm_loadu_si128((const __m128i *) (in + 32));
+    x3 = _mm_loadu_si128((const __m128i *) (in + 48));
+    in += 64;
+    n -= 64;
+
+#define CRC32_FOLD(x, k, next) \
+    x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), \
+                                    _mm_clmulepi64_si128(x, k, 0x11)), \
+                      next)
+    while (n >= 64) {
+        CRC32_FOLD(x0, k1k2, _mm_loadu_si128((const __m128i *) in));
+        CRC32_FOLD(x1, k1k2, _mm_loadu_si128((const __m128i *) (in + 16)));
+        CRC32_FOLD(x2, k1k2, _mm_loadu_si128((const __m128i *) (in + 32)));
+        CRC32_FOLD(x3, k1k2, _mm_loadu_si128((const __m128i *) (in + 48)));
+        in += 64;
+        n -= 64;
+    }
+
+    CRC32_FOLD(x0, k3k4, x1);
+    CRC32_FOLD(x0, k3k4, x2);
+    CRC32_FOLD(x0, k3k4, x3);
+    while (n >= 16) {
+        CRC32_FOLD(x0, k3k4, _mm_loadu_si128((const __m128i *) in));
+        in += 16;
+        n -= 16;
+    }
+#undef CRC32_FOLD
+
+    /* Fold 128 bits down to 64, then to 32 plus the bits still to be
+     * reduced. */
+    x0 = _mm_xor_si128(_mm_srli_si128(x0, 8),
+                       _mm_clmulepi64_si128(x0, k3k4, 0x10));
+    x4 = _mm_srli_si128(x0, 4);
+    x0 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5,
+                                            0x00),
+                       x4);
+
+    /* Barrett reduction. */
+    x5 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+    x5 = _mm_clmulepi64_si128(_mm_and_si128(x5, mask32), poly, 0x00);
+    *crcp = (uint32_t) _mm_extract_epi32(_mm_xor_si128(x0, x5), 1);
+
+    return done;
+}
+
+/* CRC-32C has its own instruction, which does up to eight bytes at once. */
+SIMD_TARGET("sse4.2")
+static size_t
+crc32c_blocks_sse42 (uint32_t *crcp, const unsigned char *in, size_t len) {
+    size_t done = len / 8 * 8, n;
+#ifdef __x86_64__
+    uint64_t crc = *crcp, v;
+
+    for (n = done; n; n -= 8, in += 8) {
+        memcpy(&v, in, 8);
+        crc = _mm_crc32_u64(crc, v);
+    }
+#else
+    uint32_t crc = *crcp, v;
+
+    for (n = done / 4; n; --n, in += 4) {
+        memcpy(&v, in, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+#endif
+
+    *crcp = (uint32_t) crc;
+    return done;
+}
+#endif
+
+static size_t
+algo_crc32_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    (void) input_size;      /* unused */
+    return 4;
+}
+
+static size_t
+algo_crc32c_size (Filter *filter, size_t input_size) {
+    return algo_crc32_size(filter, input_size);
+}
+
+static size_t
+algo_crc32_export_state (Filter *filter, uint32_t *words) {
+    CRC32State *state = ALGO_STATE(filter);
+    words[0] = state->crc;
+    return 1;
+}
+
+static int
+algo_crc32_import_state (Filter *filter, const uint32_t *words,
+                         size_t num_words)
+{
+    CRC32State *state = ALGO_STATE(filter);
+    if (num_words != 1)
+        return 0;
+    state->crc = words[0];
+    return 1;
+}
+
+static size_t
+algo_crc32c_export_state (Filter *filter, uint32_t *words) {
+    return algo_crc32_export_state(filter, words);
+}
+
+static int
+algo_crc32c_import_state (Filter *filter, const uint32_t *words,
+                          size_t num_words)
+{
+    return algo_crc32_import_state(filter, words, num_words);
+}
+
+/* Write out the final CRC in the same byte order as adler32 does. */
+static void
+crc32_output (Filter *filter, uint32_t crc,
+              unsigned char *out, unsigned char *out_max)
+{
+    crc ^= 0xFFFFFFFF;
+    if (out_max - out < 4)
+        out = filter->do_output(filter, out, &out_max);
+    *out++ = crc >> 24;
+    *out++ = (crc >> 16) & 0xFF;
+    *out++ = (crc >> 8) & 0xFF;
+    *out++ = crc & 0xFF;
+    filter->buf_out_end = out;
+}
+
+static const unsigned char *
+algo_crc32 (Filter *filter,
+            const unsigned char *in, const unsigned char *in_end,
+            unsigned char *out, unsigned char *out_max, int eof)
+{
+    CRC32State *state = ALGO_STATE(filter);
+    uint32_t crc = state->crc;
+
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.pclmul && in_end - in >= 64)
+        in += crc32_blocks_pclmul(&crc, in, in_end - in);
+#endif
+    state->crc = crc32_update(crc32_table, crc, in, in_end - in);
+
+    if (eof)
+        crc32_output(filter, state->crc, out, out_max);
+
+    return in_end;
+}
+
+static const unsigned char *
+algo_crc32c (Filter *filter,
+             const unsigned char *in, const unsigned char *in_end,
+             unsigned char *out, unsigned char *out_max, int eof)
+{
+    CRC32State *state = ALGO_STATE(filter);
+    uint32_t crc = state->crc;
+
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.sse42)
+        in += crc32c_blocks_sse42(&crc, in, in_end - in);
+#endif
+    state->crc = crc32_update(crc32c_table, crc, in, in_end - in);
+
+    if (eof)
+        crc32_output(filter, state->crc, out, out_max);
+
+    return in_end;
+}
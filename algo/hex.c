@@ -1,47 +1,167 @@
-/* lua-datafilter algorithms: base64_encode, base64_decode */
+/* lua-datafilter algorithms: hex_lower, hex_upper, hex_decode */
 
 typedef struct HexDecodeState_ {
     int got_first_digit, first_digit_val;
 } HexDecodeState;
 
+#ifdef DATAFILTER_X86_SIMD
+/* Each step splits 16 bytes into nibbles and looks up all their digits with
+ * a single shuffle, giving 32 bytes of output. */
+SIMD_TARGET("ssse3")
+static size_t
+hex_encode_bytes_ssse3 (const unsigned char *codes, const unsigned char *in,
+                        size_t len, unsigned char *out)
+{
+    const __m128i table = _mm_loadu_si128((const __m128i *) codes),
+                  nibble_mask = _mm_set1_epi8(0x0F);
+    __m128i bytes, hi, lo;
+    size_t done = 0;
+
+    while (len - done >= 16) {
+        bytes = _mm_loadu_si128((const __m128i *) (in + done));
+        hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4),
+                                                   nibble_mask));
+        lo = _mm_shuffle_epi8(table, _mm_and_si128(bytes, nibble_mask));
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(hi, lo));
+        done += 16;
+        out += 32;
+    }
+
+    return done;
+}
+
+/* The same, but for 32 bytes at a time.  The unpacking interleaves the
+ * digits within each 128 bit lane, so the lanes need to be put back in
+ * order before storing them. */
+SIMD_TARGET("avx2")
+static size_t
+hex_encode_bytes_avx2 (const unsigned char *codes, const unsigned char *in,
+                       size_t len, unsigned char *out)
+{
+    const __m256i table = _mm256_broadcastsi128_si256(
+                              _mm_loadu_si128((const __m128i *) codes)),
+                  nibble_mask = _mm256_set1_epi8(0x0F);
+    __m256i bytes, hi, lo, first, second;
+    size_t done = 0;
+
+    while (len - done >= 32) {
+        bytes = _mm256_loadu_si256((const __m256i *) (in + done));
+        hi = _mm256_shuffle_epi8(table,
+                 _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask));
+        lo = _mm256_shuffle_epi8(table,
+                                 _mm256_and_si256(bytes, nibble_mask));
+        first = _mm256_unpacklo_epi8(hi, lo);
+        second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *) out,
+                            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *) (out + 32),
+                            _mm256_permute2x128_si256(first, second, 0x31));
+        done += 32;
+        out += 64;
+    }
+
+    return done;
+}
+#endif
+
+/* Shared by both hex encoders, which only differ in the digits used.  The
+ * output space is only checked once for each run of input which will fit. */
 static const unsigned char *
-algo_hex_lower (Filter *filter,
-                const unsigned char *in, const unsigned char *in_end,
-                unsigned char *out, unsigned char *out_max, int eof)
+hex_encode (Filter *filter, const unsigned char *codes,
+            const unsigned char *in, const unsigned char *in_end,
+            unsigned char *out, unsigned char *out_max)
 {
+    size_t len, done;
     unsigned int n;
-    (void) eof;     /* unused arg */
 
     while (in < in_end) {
         if (out_max - out < 2)
             out = filter->do_output(filter, out, &out_max);
-        n = *in++;
-        *out++ = hex_char_codes_lower[n >> 4];
-        *out++ = hex_char_codes_lower[n & 0xF];
+
+        len = in_end - in;
+        if (len > (size_t) (out_max - out) / 2)
+            len = (out_max - out) / 2;
+        done = 0;
+#ifdef DATAFILTER_X86_SIMD
+        if (cpu_has.avx2)
+            done = hex_encode_bytes_avx2(codes, in, len, out);
+        if (cpu_has.ssse3)
+            done += hex_encode_bytes_ssse3(codes, in + done, len - done,
+                                           out + done * 2);
+        in += done;
+        out += done * 2;
+#endif
+
+        for (; done < len; ++done) {
+            n = *in++;
+            *out++ = codes[n >> 4];
+            *out++ = codes[n & 0xF];
+        }
     }
 
     filter->buf_out_end = out;
     return in;
 }
 
+static size_t
+algo_hex_lower_chunk_align (Filter *filter) {
+    (void) filter;          /* unused */
+    return 1;
+}
+
+static size_t
+algo_hex_lower_chunk_size (Filter *filter, const unsigned char *in,
+                           size_t len)
+{
+    (void) filter;          /* unused */
+    (void) in;              /* unused */
+    return len * 2;
+}
+
+static size_t
+algo_hex_lower_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size * 2;
+}
+
 static const unsigned char *
-algo_hex_upper (Filter *filter,
+algo_hex_lower (Filter *filter,
                 const unsigned char *in, const unsigned char *in_end,
                 unsigned char *out, unsigned char *out_max, int eof)
 {
-    unsigned int n;
     (void) eof;     /* unused arg */
+    return hex_encode(filter, hex_char_codes_lower, in, in_end, out, out_max);
+}
 
-    while (in < in_end) {
-        if (out_max - out < 2)
-            out = filter->do_output(filter, out, &out_max);
-        n = *in++;
-        *out++ = hex_char_codes_upper[n >> 4];
-        *out++ = hex_char_codes_upper[n & 0xF];
-    }
+static size_t
+algo_hex_upper_chunk_align (Filter *filter) {
+    (void) filter;          /* unused */
+    return 1;
+}
 
-    filter->buf_out_end = out;
-    return in;
+static size_t
+algo_hex_upper_chunk_size (Filter *filter, const unsigned char *in,
+                           size_t len)
+{
+    (void) filter;          /* unused */
+    (void) in;              /* unused */
+    return len * 2;
+}
+
+static size_t
+algo_hex_upper_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size * 2;
+}
+
+static const unsigned char *
+algo_hex_upper (Filter *filter,
+                const unsigned char *in, const unsigned char *in_end,
+                unsigned char *out, unsigned char *out_max, int eof)
+{
+    (void) eof;     /* unused arg */
+    return hex_encode(filter, hex_char_codes_upper, in, in_end, out, out_max);
 }
 
 static int
@@ -52,6 +172,145 @@ algo_hex_decode_init (Filter *filter, int options_pos) {
     return 1;
 }
 
+#ifdef DATAFILTER_X86_SIMD
+/* Work out the values of 16 hex digits, or return false if any of them
+ * aren't hex digits. */
+SIMD_TARGET("ssse3")
+static int
+hex_decode_values_ssse3 (__m128i in, __m128i *values) {
+    __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8(48)),
+            letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(32)),
+                                  _mm_set1_epi8(97)),
+            is_digit, is_letter;
+
+    is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF)
+        return 0;
+
+    *values = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                           _mm_and_si128(is_letter,
+                                         _mm_add_epi8(letter,
+                                                      _mm_set1_epi8(10))));
+    return 1;
+}
+
+/* Each step decodes 32 digits into 16 bytes, by combining pairs of values
+ * into 16 bit numbers with a multiply-add, then packing them into bytes. */
+SIMD_TARGET("ssse3")
+static size_t
+hex_decode_bytes_ssse3 (const unsigned char *in, unsigned char *out,
+                        size_t len)
+{
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i first, second;
+    size_t done = 0;
+
+    while (len - done >= 16) {
+        if (!hex_decode_values_ssse3(
+                 _mm_loadu_si128((const __m128i *) in), &first) ||
+            !hex_decode_values_ssse3(
+                 _mm_loadu_si128((const __m128i *) (in + 16)), &second))
+            break;
+        _mm_storeu_si128((__m128i *) (out + done), _mm_packus_epi16(
+            _mm_maddubs_epi16(first, weights),
+            _mm_maddubs_epi16(second, weights)));
+        in += 32;
+        done += 16;
+    }
+
+    return done;
+}
+
+SIMD_TARGET("avx2")
+static int
+hex_decode_values_avx2 (__m256i in, __m256i *values) {
+    __m256i digit = _mm256_sub_epi8(in, _mm256_set1_epi8(48)),
+            letter = _mm256_sub_epi8(_mm256_or_si256(in, _mm256_set1_epi8(32)),
+                                     _mm256_set1_epi8(97)),
+            is_digit, is_letter;
+
+    is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)),
+                                 digit);
+    is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)),
+                                  letter);
+    if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1)
+        return 0;
+
+    *values = _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                              _mm256_and_si256(is_letter,
+                                  _mm256_add_epi8(letter,
+                                                  _mm256_set1_epi8(10))));
+    return 1;
+}
+
+/* 64 digits into 32 bytes.  The pack instruction works within 128 bit
+ * lanes, so the 64 bit quarters of the result need reordering. */
+SIMD_TARGET("avx2")
+static size_t
+hex_decode_bytes_avx2 (const unsigned char *in, unsigned char *out,
+                       size_t len)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i first, second;
+    size_t done = 0;
+
+    while (len - done >= 32) {
+        if (!hex_decode_values_avx2(
+                 _mm256_loadu_si256((const __m256i *) in), &first) ||
+            !hex_decode_values_avx2(
+                 _mm256_loadu_si256((const __m256i *) (in + 32)), &second))
+            break;
+        _mm256_storeu_si256((__m256i *) (out + done), _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(_mm256_maddubs_epi16(first, weights),
+                                _mm256_maddubs_epi16(second, weights)),
+            0xD8));
+        in += 64;
+        done += 32;
+    }
+
+    return done;
+}
+#endif
+
+/* Decode a run of pairs of hex digits, stopping at the first pair which
+ * isn't two valid digits (usually whitespace), or when the output buffer
+ * is full.  Returns the number of bytes output, each of which used up two
+ * bytes of input. */
+static size_t
+hex_decode_bulk (const unsigned char *in, const unsigned char *in_end,
+                 unsigned char *out, const unsigned char *out_max)
+{
+    size_t len = (in_end - in) / 2, done = 0;
+    int hi, lo;
+
+    if (len > (size_t) (out_max - out))
+        len = out_max - out;
+
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.avx2)
+        done = hex_decode_bytes_avx2(in, out, len);
+    if (cpu_has.ssse3)
+        done += hex_decode_bytes_ssse3(in + done * 2, out + done, len - done);
+#endif
+
+    for (; done < len; ++done) {
+        hi = hex_char_value[in[done * 2]];
+        lo = hex_char_value[in[done * 2 + 1]];
+        if (hi < 0 || lo < 0)
+            break;
+        out[done] = (hi << 4) | lo;
+    }
+
+    return done;
+}
+
+static size_t
+algo_hex_decode_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size / 2 + 1;
+}
+
 static const unsigned char *
 algo_hex_decode (Filter *filter,
                  const unsigned char *in, const unsigned char *in_end,
@@ -62,11 +321,20 @@ algo_hex_decode (Filter *filter,
         first_digit_val = state->first_digit_val;
     unsigned char c;
     int val;
+    size_t n;
     (void) eof;     /* unused arg */
 
     while (in < in_end) {
+        if (!got_first_digit) {
+            n = hex_decode_bulk(in, in_end, out, out_max);
+            in += n * 2;
+            out += n;
+            if (in == in_end)
+                break;
+        }
+
         c = *in++;
-        if (isspace(c))
+        if (my_isspace(c))
             continue;
         val = hex_char_value[c];
         if (val == -1)
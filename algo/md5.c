@@ -148,6 +148,180 @@ md5_bytestoword32 (uint32_t *x, const uint8_t *pt) {
     }
 }
 
+static const uint32_t
+md5_initial_state[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+
+/* Multi-buffer MD5, for md5_many().  The state is one word per lane for
+ * each of the four digest words, and each lane gets its own block.  Lanes
+ * not flagged in 'active' are left alone. */
+static void
+md5_digest_lanes (uint32_t *state, const unsigned char *const *blocks,
+                  unsigned int active)
+{
+    uint32_t wbuff[16], d[4];
+    int lane, i;
+
+    for (lane = 0; active; ++lane, active >>= 1) {
+        if (!(active & 1))
+            continue;
+        for (i = 0; i < 4; ++i)
+            d[i] = state[i * MULTIBUF_MAX_LANES + lane];
+        md5_bytestoword32(wbuff, blocks[lane]);
+        md5_digest(wbuff, d);
+        for (i = 0; i < 4; ++i)
+            state[i * MULTIBUF_MAX_LANES + lane] = d[i];
+    }
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* The same steps as md5_digest(), but on vectors with each 32 bit lane
+ * hashing a different message.  The V* operations are defined below for
+ * each instruction set. */
+#define MD5X_F(x, y, z) VOR(VAND(x, y), VANDNOT(x, z))
+#define MD5X_G(x, y, z) VOR(VAND(x, z), VANDNOT(z, y))
+#define MD5X_H(x, y, z) VXOR(VXOR(x, y), z)
+#define MD5X_I(x, y, z) VXOR(y, VOR(x, VXOR(z, ones)))
+#define MD5X_STEP(func, a, b, c, d, k, s, t) \
+    a = VADD(VADD(a, func(b, c, d)), VADD(m[k], VSET1(T[t]))); \
+    a = VADD(VOR(VSLLI(a, s), VSRLI(a, 32 - (s))), b);
+#define MD5X_ROUNDS \
+    for (j = 0; j < 16; j += 4) { \
+        MD5X_STEP(MD5X_F, a, b, c, d, j, 7, j) \
+        MD5X_STEP(MD5X_F, d, a, b, c, j + 1, 12, j + 1) \
+        MD5X_STEP(MD5X_F, c, d, a, b, j + 2, 17, j + 2) \
+        MD5X_STEP(MD5X_F, b, c, d, a, j + 3, 22, j + 3) \
+    } \
+    for (j = 0; j < 16; j += 4) { \
+        MD5X_STEP(MD5X_G, a, b, c, d, (5 * j + 1) & 15, 5, j + 16) \
+        MD5X_STEP(MD5X_G, d, a, b, c, (5 * j + 6) & 15, 9, j + 17) \
+        MD5X_STEP(MD5X_G, c, d, a, b, (5 * j + 11) & 15, 14, j + 18) \
+        MD5X_STEP(MD5X_G, b, c, d, a, (5 * j + 16) & 15, 20, j + 19) \
+    } \
+    for (j = 0; j < 16; j += 4) { \
+        MD5X_STEP(MD5X_H, a, b, c, d, (3 * j + 5) & 15, 4, j + 32) \
+        MD5X_STEP(MD5X_H, d, a, b, c, (3 * j + 8) & 15, 11, j + 33) \
+        MD5X_STEP(MD5X_H, c, d, a, b, (3 * j + 11) & 15, 16, j + 34) \
+        MD5X_STEP(MD5X_H, b, c, d, a, (3 * j + 14) & 15, 23, j + 35) \
+    } \
+    for (j = 0; j < 16; j += 4) { \
+        MD5X_STEP(MD5X_I, a, b, c, d, (7 * j) & 15, 6, j + 48) \
+        MD5X_STEP(MD5X_I, d, a, b, c, (7 * j + 7) & 15, 10, j + 49) \
+        MD5X_STEP(MD5X_I, c, d, a, b, (7 * j + 14) & 15, 15, j + 50) \
+        MD5X_STEP(MD5X_I, b, c, d, a, (7 * j + 21) & 15, 21, j + 51) \
+    }
+
+#define VADD _mm_add_epi32
+#define VAND _mm_and_si128
+#define VANDNOT _mm_andnot_si128
+#define VOR _mm_or_si128
+#define VXOR _mm_xor_si128
+#define VSLLI _mm_slli_epi32
+#define VSRLI _mm_srli_epi32
+#define VSET1 _mm_set1_epi32
+
+SIMD_TARGET("sse2")
+static void
+md5_digest_x4_sse2 (uint32_t *state, const unsigned char *const *blocks,
+                    unsigned int active)
+{
+    __m128i m[16], a, b, c, d, mask, *p;
+    const __m128i ones = _mm_set1_epi32(-1);
+    int j;
+
+    multibuf_load_x4_sse2(m, blocks);
+
+    p = (__m128i *) state;
+    a = _mm_loadu_si128(p);
+    b = _mm_loadu_si128(p + MULTIBUF_MAX_LANES / 4);
+    c = _mm_loadu_si128(p + 2 * MULTIBUF_MAX_LANES / 4);
+    d = _mm_loadu_si128(p + 3 * MULTIBUF_MAX_LANES / 4);
+
+    MD5X_ROUNDS
+
+    /* Add to the old state, but only in the active lanes. */
+    mask = multibuf_mask_x4_sse2(active);
+    m[0] = a;  m[1] = b;  m[2] = c;  m[3] = d;
+    for (j = 0; j < 4; ++j, p += MULTIBUF_MAX_LANES / 4)
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p),
+                                          _mm_and_si128(m[j], mask)));
+}
+
+#undef VADD
+#undef VAND
+#undef VANDNOT
+#undef VOR
+#undef VXOR
+#undef VSLLI
+#undef VSRLI
+#undef VSET1
+#define VADD _mm256_add_epi32
+#define VAND _mm256_and_si256
+#define VANDNOT _mm256_andnot_si256
+#define VOR _mm256_or_si256
+#define VXOR _mm256_xor_si256
+#define VSLLI _mm256_slli_epi32
+#define VSRLI _mm256_srli_epi32
+#define VSET1 _mm256_set1_epi32
+
+SIMD_TARGET("avx2")
+static void
+md5_digest_x8_avx2 (uint32_t *state, const unsigned char *const *blocks,
+                    unsigned int active)
+{
+    __m256i m[16], a, b, c, d, mask, *p;
+    const __m256i ones = _mm256_set1_epi32(-1);
+    int j;
+
+    multibuf_load_x8_avx2(m, blocks);
+
+    p = (__m256i *) state;
+    a = _mm256_loadu_si256(p);
+    b = _mm256_loadu_si256(p + 1);
+    c = _mm256_loadu_si256(p + 2);
+    d = _mm256_loadu_si256(p + 3);
+
+    MD5X_ROUNDS
+
+    mask = multibuf_mask_x8_avx2(active);
+    m[0] = a;  m[1] = b;  m[2] = c;  m[3] = d;
+    for (j = 0; j < 4; ++j, ++p)
+        _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p),
+                                                _mm256_and_si256(m[j], mask)));
+}
+
+#undef VADD
+#undef VAND
+#undef VANDNOT
+#undef VOR
+#undef VXOR
+#undef VSLLI
+#undef VSRLI
+#undef VSET1
+#undef MD5X_F
+#undef MD5X_G
+#undef MD5X_H
+#undef MD5X_I
+#undef MD5X_STEP
+#undef MD5X_ROUNDS
+#endif
+
+static void
+md5_multibuf_setup (MultiBufHash *hash) {
+    hash->digest_words = 4;
+    hash->big_endian = 0;
+    hash->initial_state = md5_initial_state;
+    hash->func = md5_digest_lanes;
+    hash->num_lanes = MULTIBUF_MAX_LANES;
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.avx2)
+        hash->func = md5_digest_x8_avx2;
+    else if (cpu_has.sse2) {
+        hash->func = md5_digest_x4_sse2;
+        hash->num_lanes = 4;
+    }
+#endif
+}
+
 typedef struct MD5State_ {
     uint32_t d[4];
     uint32_t len_low, len_high;     // split up, so doesn't rely on 64 bit nums
@@ -158,15 +332,43 @@ algo_md5_init (Filter *filter, int options_pos) {
     MD5State *decoder_state = ALGO_STATE(filter);
     (void) options_pos;     /* unused */
 
-    decoder_state->d[0] = 0x67452301;
-    decoder_state->d[1] = 0xEFCDAB89;
-    decoder_state->d[2] = 0x98BADCFE;
-    decoder_state->d[3] = 0x10325476;
+    memcpy(decoder_state->d, md5_initial_state, sizeof(md5_initial_state));
 
     decoder_state->len_low = decoder_state->len_high = 0;
     return 1;
 }
 
+static size_t
+algo_md5_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    (void) input_size;      /* unused */
+    return 16;
+}
+
+static size_t
+algo_md5_export_state (Filter *filter, uint32_t *words) {
+    MD5State *decoder_state = ALGO_STATE(filter);
+    memcpy(words, decoder_state->d, 4 * sizeof(uint32_t));
+    words[4] = decoder_state->len_low;
+    words[5] = decoder_state->len_high;
+    return 6;
+}
+
+static int
+algo_md5_import_state (Filter *filter, const uint32_t *words,
+                       size_t num_words)
+{
+    MD5State *decoder_state = ALGO_STATE(filter);
+
+    /* Only whole blocks are counted until the end of the input. */
+    if (num_words != 6 || (words[4] & 511) != 0)
+        return 0;
+    memcpy(decoder_state->d, words, 4 * sizeof(uint32_t));
+    decoder_state->len_low = words[4];
+    decoder_state->len_high = words[5];
+    return 1;
+}
+
 static const unsigned char *
 algo_md5 (Filter *filter,
           const unsigned char *in, const unsigned char *in_end,
@@ -178,6 +380,7 @@ algo_md5 (Filter *filter,
     uint8_t buff[64];
     const unsigned char *in_start = in;
     uint32_t num_bits;
+    size_t num_bytes;
 
     while (in_end - in >= 64) {
         md5_bytestoword32(wbuff, in);
@@ -186,16 +389,18 @@ algo_md5 (Filter *filter,
     }
 
     if (eof)
-        num_bits = (in_end - in_start) * 8;     /* everything that's left */
+        num_bytes = in_end - in_start;          /* everything that's left */
     else
-        num_bits = (in - in_start) * 8;         /* just what's done so far */
+        num_bytes = in - in_start;              /* just what's done so far */
 
+    /* A single call can be given more than 2^32 bits, so the top bits of
+     * the count have to go into the high word as well as the carry. */
+    num_bits = (uint32_t) (num_bytes << 3);
     decoder_state->len_low += num_bits;
     decoder_state->len_low &= 0xFFFFFFFF;
-    if (decoder_state->len_low < num_bits) {
-        ++decoder_state->len_high;
-        decoder_state->len_high &= 0xFFFFFFFF;
-    }
+    decoder_state->len_high += (uint32_t) (num_bytes >> 29) +
+                               (decoder_state->len_low < num_bits);
+    decoder_state->len_high &= 0xFFFFFFFF;
 
     if (eof) {
         int numbytes = in_end - in;
@@ -69,6 +69,35 @@ algo_percent_encode_init (Filter *filter, int options_pos) {
     return 1;
 }
 
+/* Could be up to three times as big, but usually most of the input is
+ * made up of safe bytes, so only allow a little extra for escapes. */
+static size_t
+algo_percent_encode_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size + input_size / 8;
+}
+
+static size_t
+algo_percent_encode_chunk_align (Filter *filter) {
+    (void) filter;          /* unused */
+    return 1;
+}
+
+/* One byte for each safe byte, three for the others. */
+static size_t
+algo_percent_encode_chunk_size (Filter *filter, const unsigned char *in,
+                                size_t len)
+{
+    PercentEncodeState *state = ALGO_STATE(filter);
+    const char *safe_bytes = state->safe_bytes;
+    const unsigned char *in_end = in + len;
+    size_t size = len;
+
+    for (; in != in_end; ++in)
+        size += safe_bytes[*in] ? 0 : 2;
+    return size;
+}
+
 static const unsigned char *
 algo_percent_encode (Filter *filter,
                     const unsigned char *in, const unsigned char *in_end,
@@ -99,6 +128,12 @@ algo_percent_encode (Filter *filter,
     return in;
 }
 
+static size_t
+algo_percent_decode_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size;
+}
+
 static const unsigned char *
 algo_percent_decode (Filter *filter,
                     const unsigned char *in, const unsigned char *in_end,
@@ -114,8 +149,10 @@ algo_percent_decode (Filter *filter,
         byte = *in++;
         if (byte == 37) {
             if (in_end - in < 2) {
-                if (!eof)
+                if (!eof) {
+                    --in;
                     break;      /* wait for more to come */
+                }
                 ALGO_ERROR("percent-encoded character incomplete at end of"
                            " input");
             }
@@ -25,6 +25,12 @@ qp_output_whitespace (Filter *filter,
     return in;
 }
 
+static size_t
+algo_qp_decode_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    return input_size;
+}
+
 static const unsigned char *
 algo_qp_decode (Filter *filter,
                 const unsigned char *in, const unsigned char *in_end,
@@ -146,6 +152,25 @@ algo_qp_encode_destroy (Filter *filter) {
                       state->line_ending_len, 0);
 }
 
+static void
+algo_qp_encode_clone (Filter *filter) {
+    QPEncodeState *state = ALGO_STATE(filter);
+    QPEncodeState *initial = ALGO_INITIAL_STATE(filter);
+    if (state->line_ending && state->line_ending != default_line_ending)
+        state->line_ending = initial->line_ending = my_strduplen(
+            filter, state->line_ending, state->line_ending_len);
+}
+
+/* A guess, assuming the input is mostly text which doesn't need escaping,
+ * with soft line breaks added to it. */
+static size_t
+algo_qp_encode_size (Filter *filter, size_t input_size) {
+    QPEncodeState *state = ALGO_STATE(filter);
+    return input_size + input_size / 8 +
+           (input_size / EMAIL_MAX_LINE_LENGTH + 1) *
+           (state->line_ending_len + 1);
+}
+
 static const unsigned char *
 algo_qp_encode (Filter *filter,
                 const unsigned char *in, const unsigned char *in_end,
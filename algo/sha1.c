@@ -9,9 +9,11 @@ static const uint32_t
 sha1_K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
 
 static void
-sha1_word32tobytes (const uint32_t *input, unsigned char *output) {
+sha1_word32tobytes (const uint32_t *input, unsigned char *output,
+                    int num_words)
+{
     int j = 0;
-    while (j < 20) {
+    while (j < num_words * 4) {
         uint32_t v = *input++;
         output[j++] = v >> 24;
         output[j++] = (v >> 16) & 0xFF;
@@ -35,7 +37,7 @@ sha1_bytestoword32 (uint32_t *x, const unsigned char *pt) {
 static void
 sha1_digest (uint32_t *w, uint32_t *h) {
     uint32_t a, b, c, d, e;
-    uint32_t temp, f;
+    uint32_t temp;
     int t;
 
     for (t = 16; t < 80; ++t) {
@@ -45,22 +47,321 @@ sha1_digest (uint32_t *w, uint32_t *h) {
 
     a = h[0];  b = h[1];  c = h[2];  d = h[3];  e = h[4];
 
-    for (t = 0; t < 80; ++t) {
-        if (t < 20)
-            f = (b & c) | ((~b) & d);
-        else if (t < 40)
-            f = b ^ c ^ d;
-        else if (t < 60)
-            f = (b & c) | (b & d) | (c & d);
-        else
-            f = b ^ c ^ d;
-        temp = rotate(a, 5) + f + e + w[t] + sha1_K[t / 20];
+#define SHA1_ROUND(f, k) \
+        temp = rotate(a, 5) + (f) + e + w[t] + (k); \
         e = d;  d = c;  c = rotate(b, 30);  b = a; a = temp;
+
+    for (t = 0; t < 20; ++t) {
+        SHA1_ROUND((b & c) | ((~b) & d), sha1_K[0])
+    }
+    for (; t < 40; ++t) {
+        SHA1_ROUND(b ^ c ^ d, sha1_K[1])
+    }
+    for (; t < 60; ++t) {
+        SHA1_ROUND((b & c) | (b & d) | (c & d), sha1_K[2])
     }
+    for (; t < 80; ++t) {
+        SHA1_ROUND(b ^ c ^ d, sha1_K[3])
+    }
+
+#undef SHA1_ROUND
 
     h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;  h[4] += e;
 }
 
+#ifdef DATAFILTER_X86_SIMD
+/* Four rounds with the SHA extensions, using the message words in 'm',
+ * while working ahead on the message schedule: finishing the words for the
+ * next four rounds (mn) and continuing with the ones after that (mnn, mp).
+ * The E value for the next rounds is kept in the other of e0 and e1. */
+#define SHA1NI_ROUNDS(func, e_in, e_out, m, mn, mnn, mp) \
+    e_in = _mm_sha1nexte_epu32(e_in, m); \
+    e_out = abcd; \
+    mn = _mm_sha1msg2_epu32(mn, m); \
+    abcd = _mm_sha1rnds4_epu32(abcd, e_in, func); \
+    mp = _mm_sha1msg1_epu32(mp, m); \
+    mnn = _mm_xor_si128(mnn, m);
+
+SIMD_TARGET("sha,sse4.1")
+static void
+sha1_blocks_shani (uint32_t *h, const unsigned char *in, size_t num_blocks) {
+    const __m128i byte_swap = _mm_set_epi64x(0x0001020304050607LL,
+                                             0x08090A0B0C0D0E0FLL);
+    __m128i abcd, abcd_save, e0, e1, e_save, msg0, msg1, msg2, msg3;
+
+    /* The instructions want A in the highest lane, and E on its own. */
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0x1B);
+    e0 = _mm_set_epi32(h[4], 0, 0, 0);
+
+    while (num_blocks--) {
+        abcd_save = abcd;
+        e_save = e0;
+
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) in),
+                                byte_swap);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 16)),
+                                byte_swap);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 32)),
+                                byte_swap);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 48)),
+                                byte_swap);
+        SHA1NI_ROUNDS(0, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1NI_ROUNDS(0, e0, e1, msg0, msg1, msg2, msg3)    /* 16-19 */
+        SHA1NI_ROUNDS(1, e1, e0, msg1, msg2, msg3, msg0)
+        SHA1NI_ROUNDS(1, e0, e1, msg2, msg3, msg0, msg1)
+        SHA1NI_ROUNDS(1, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1NI_ROUNDS(1, e0, e1, msg0, msg1, msg2, msg3)
+        SHA1NI_ROUNDS(1, e1, e0, msg1, msg2, msg3, msg0)    /* 36-39 */
+        SHA1NI_ROUNDS(2, e0, e1, msg2, msg3, msg0, msg1)
+        SHA1NI_ROUNDS(2, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1NI_ROUNDS(2, e0, e1, msg0, msg1, msg2, msg3)
+        SHA1NI_ROUNDS(2, e1, e0, msg1, msg2, msg3, msg0)
+        SHA1NI_ROUNDS(2, e0, e1, msg2, msg3, msg0, msg1)    /* 56-59 */
+        SHA1NI_ROUNDS(3, e1, e0, msg3, msg0, msg1, msg2)
+        SHA1NI_ROUNDS(3, e0, e1, msg0, msg1, msg2, msg3)
+
+        /* The schedule is complete, so the last few rounds have less
+         * work to do. */
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+
+        in += 64;
+    }
+
+    _mm_storeu_si128((__m128i *) h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1NI_ROUNDS
+#endif
+
+/* Run the compression function over some whole 64 byte blocks. */
+static void
+sha1_blocks (uint32_t *h, const unsigned char *in, size_t num_blocks) {
+    /* Only the first 16 words of this are loaded here, the rest is only used
+     * inside sha1_digest. */
+    uint32_t wbuff[80];
+
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.sha) {
+        sha1_blocks_shani(h, in, num_blocks);
+        return;
+    }
+#endif
+
+    while (num_blocks--) {
+        sha1_bytestoword32(wbuff, in);
+        sha1_digest(wbuff, h);
+        in += 64;
+    }
+}
+
+static const uint32_t
+sha1_initial_state[5] = {
+    0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+/* Multi-buffer SHA-1, for sha1_many().  The state is one word per lane for
+ * each of the five digest words, and each lane gets its own block.  Lanes
+ * not flagged in 'active' are left alone. */
+static void
+sha1_digest_lanes (uint32_t *state, const unsigned char *const *blocks,
+                   unsigned int active)
+{
+    uint32_t h[5];
+    int lane, i;
+
+    for (lane = 0; active; ++lane, active >>= 1) {
+        if (!(active & 1))
+            continue;
+        for (i = 0; i < 5; ++i)
+            h[i] = state[i * MULTIBUF_MAX_LANES + lane];
+        sha1_blocks(h, blocks[lane], 1);
+        for (i = 0; i < 5; ++i)
+            state[i * MULTIBUF_MAX_LANES + lane] = h[i];
+    }
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* The same as sha1_digest(), but on vectors with each 32 bit lane hashing a
+ * different message.  The V* operations are defined below for each
+ * instruction set. */
+#define SHA1X_ROTATE(x, n) VOR(VSLLI(x, n), VSRLI(x, 32 - (n)))
+#define SHA1X_ROUND(f, k) \
+    temp = VADD(VADD(SHA1X_ROTATE(a, 5), f), VADD(VADD(e, w[t]), k)); \
+    e = d;  d = c;  c = SHA1X_ROTATE(b, 30);  b = a;  a = temp;
+#define SHA1X_ROUNDS \
+    for (t = 16; t < 80; ++t) { \
+        temp = VXOR(VXOR(w[t - 3], w[t - 8]), VXOR(w[t - 14], w[t - 16])); \
+        w[t] = SHA1X_ROTATE(temp, 1); \
+    } \
+    k = VSET1(sha1_K[0]); \
+    for (t = 0; t < 20; ++t) { \
+        SHA1X_ROUND(VOR(VAND(b, c), VANDNOT(b, d)), k) \
+    } \
+    k = VSET1(sha1_K[1]); \
+    for (; t < 40; ++t) { \
+        SHA1X_ROUND(VXOR(VXOR(b, c), d), k) \
+    } \
+    k = VSET1(sha1_K[2]); \
+    for (; t < 60; ++t) { \
+        SHA1X_ROUND(VOR(VAND(b, c), VAND(d, VOR(b, c))), k) \
+    } \
+    k = VSET1(sha1_K[3]); \
+    for (; t < 80; ++t) { \
+        SHA1X_ROUND(VXOR(VXOR(b, c), d), k) \
+    }
+
+#define VADD _mm_add_epi32
+#define VAND _mm_and_si128
+#define VANDNOT _mm_andnot_si128
+#define VOR _mm_or_si128
+#define VXOR _mm_xor_si128
+#define VSLLI _mm_slli_epi32
+#define VSRLI _mm_srli_epi32
+#define VSET1 _mm_set1_epi32
+
+SIMD_TARGET("sse2")
+static void
+sha1_digest_x4_sse2 (uint32_t *state, const unsigned char *const *blocks,
+                     unsigned int active)
+{
+    __m128i w[80], a, b, c, d, e, k, temp, mask, *p;
+    int t;
+
+    /* Without SSSE3 the words are byte swapped with 16 bit shifts and
+     * shuffles. */
+    multibuf_load_x4_sse2(w, blocks);
+    for (t = 0; t < 16; ++t) {
+        temp = _mm_or_si128(_mm_slli_epi16(w[t], 8), _mm_srli_epi16(w[t], 8));
+        w[t] = _mm_shufflehi_epi16(_mm_shufflelo_epi16(temp, 0xB1), 0xB1);
+    }
+
+    p = (__m128i *) state;
+    a = _mm_loadu_si128(p);
+    b = _mm_loadu_si128(p + MULTIBUF_MAX_LANES / 4);
+    c = _mm_loadu_si128(p + 2 * MULTIBUF_MAX_LANES / 4);
+    d = _mm_loadu_si128(p + 3 * MULTIBUF_MAX_LANES / 4);
+    e = _mm_loadu_si128(p + 4 * MULTIBUF_MAX_LANES / 4);
+
+    SHA1X_ROUNDS
+
+    /* Add to the old state, but only in the active lanes. */
+    mask = multibuf_mask_x4_sse2(active);
+    w[0] = a;  w[1] = b;  w[2] = c;  w[3] = d;  w[4] = e;
+    for (t = 0; t < 5; ++t, p += MULTIBUF_MAX_LANES / 4)
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p),
+                                          _mm_and_si128(w[t], mask)));
+}
+
+#undef VADD
+#undef VAND
+#undef VANDNOT
+#undef VOR
+#undef VXOR
+#undef VSLLI
+#undef VSRLI
+#undef VSET1
+#define VADD _mm256_add_epi32
+#define VAND _mm256_and_si256
+#define VANDNOT _mm256_andnot_si256
+#define VOR _mm256_or_si256
+#define VXOR _mm256_xor_si256
+#define VSLLI _mm256_slli_epi32
+#define VSRLI _mm256_srli_epi32
+#define VSET1 _mm256_set1_epi32
+
+SIMD_TARGET("avx2")
+static void
+sha1_digest_x8_avx2 (uint32_t *state, const unsigned char *const *blocks,
+                     unsigned int active)
+{
+    const __m256i byte_swap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i w[80], a, b, c, d, e, k, temp, mask, *p;
+    int t;
+
+    multibuf_load_x8_avx2(w, blocks);
+    for (t = 0; t < 16; ++t)
+        w[t] = _mm256_shuffle_epi8(w[t], byte_swap);
+
+    p = (__m256i *) state;
+    a = _mm256_loadu_si256(p);
+    b = _mm256_loadu_si256(p + 1);
+    c = _mm256_loadu_si256(p + 2);
+    d = _mm256_loadu_si256(p + 3);
+    e = _mm256_loadu_si256(p + 4);
+
+    SHA1X_ROUNDS
+
+    mask = multibuf_mask_x8_avx2(active);
+    w[0] = a;  w[1] = b;  w[2] = c;  w[3] = d;  w[4] = e;
+    for (t = 0; t < 5; ++t, ++p)
+        _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p),
+                                                _mm256_and_si256(w[t], mask)));
+}
+
+#undef VADD
+#undef VAND
+#undef VANDNOT
+#undef VOR
+#undef VXOR
+#undef VSLLI
+#undef VSRLI
+#undef VSET1
+#undef SHA1X_ROUNDS
+#undef SHA1X_ROUND
+#undef SHA1X_ROTATE
+#endif
+
+static void
+sha1_multibuf_setup (MultiBufHash *hash) {
+    hash->digest_words = 5;
+    hash->big_endian = 1;
+    hash->initial_state = sha1_initial_state;
+    hash->func = sha1_digest_lanes;
+    hash->num_lanes = MULTIBUF_MAX_LANES;
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.avx2)
+        hash->func = sha1_digest_x8_avx2;
+    else if (cpu_has.sse2 && !cpu_has.sha) {
+        hash->func = sha1_digest_x4_sse2;
+        hash->num_lanes = 4;
+    }
+#endif
+}
+
 typedef struct SHA1State_ {
     uint32_t h[5];
     uint32_t len_low, len_high;
@@ -71,16 +372,43 @@ algo_sha1_init (Filter *filter, int options_pos) {
     SHA1State *state = ALGO_STATE(filter);
     (void) options_pos;     /* unused */
 
-    state->h[0] = 0x67452301;
-    state->h[1] = 0xEFCDAB89;
-    state->h[2] = 0x98BADCFE;
-    state->h[3] = 0x10325476;
-    state->h[4] = 0xC3D2E1F0;
+    memcpy(state->h, sha1_initial_state, sizeof(sha1_initial_state));
 
     state->len_low = state->len_high = 0;
     return 1;
 }
 
+static size_t
+algo_sha1_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    (void) input_size;      /* unused */
+    return 20;
+}
+
+static size_t
+algo_sha1_export_state (Filter *filter, uint32_t *words) {
+    SHA1State *state = ALGO_STATE(filter);
+    memcpy(words, state->h, 5 * sizeof(uint32_t));
+    words[5] = state->len_low;
+    words[6] = state->len_high;
+    return 7;
+}
+
+static int
+algo_sha1_import_state (Filter *filter, const uint32_t *words,
+                        size_t num_words)
+{
+    SHA1State *state = ALGO_STATE(filter);
+
+    /* Only whole blocks are counted until the end of the input. */
+    if (num_words != 7 || (words[5] & 511) != 0)
+        return 0;
+    memcpy(state->h, words, 5 * sizeof(uint32_t));
+    state->len_low = words[5];
+    state->len_high = words[6];
+    return 1;
+}
+
 static const unsigned char *
 algo_sha1 (Filter *filter,
            const unsigned char *in, const unsigned char *in_end,
@@ -88,53 +416,46 @@ algo_sha1 (Filter *filter,
 {
     SHA1State *state = ALGO_STATE(filter);
     uint32_t *h = state->h;
-    unsigned char buff[64];
+    unsigned char buff[128];
     const unsigned char *in_start = in;
-    unsigned long num_bits;
+    uint32_t num_bits;
+    size_t num_bytes;
+    size_t num_blocks = (in_end - in) / 64;
 
-    /* Only the first 16 words of this are loaded here, the rest is only used
-     * inside sha1_digest. */
-    uint32_t wbuff[80];
-
-    while (in_end - in >= 64) {
-        sha1_bytestoword32(wbuff, in);
-        sha1_digest(wbuff, h);
-        in += 64;
-    }
+    sha1_blocks(h, in, num_blocks);
+    in += num_blocks * 64;
 
     if (eof)
-        num_bits = (in_end - in_start) * 8;     /* everything that's left */
+        num_bytes = in_end - in_start;          /* everything that's left */
     else
-        num_bits = (in - in_start) * 8;         /* just what's done so far */
+        num_bytes = in - in_start;              /* just what's done so far */
 
+    /* The length is kept as two 32 bit halves, and this call's share can
+     * itself be too big for the low one. */
+    num_bits = (uint32_t) (num_bytes << 3);
     state->len_low += num_bits;
     state->len_low &= 0xFFFFFFFF;
-    if (state->len_low < num_bits) {
-        ++state->len_high;
-        state->len_high &= 0xFFFFFFFF;
-    }
+    state->len_high += (uint32_t) (num_bytes >> 29) +
+                       (state->len_low < num_bits);
+    state->len_high &= 0xFFFFFFFF;
 
     if (eof) {
+        /* Pad to one or two blocks, with the length at the end. */
         int numbytes = in_end - in;
+        uint32_t len[2];
+        len[0] = state->len_high;
+        len[1] = state->len_low;
+        num_blocks = numbytes > 64 - 9 ? 2 : 1;
         memcpy(buff, in, numbytes);
         in += numbytes;
-        memset(buff + numbytes, 0, 64 - numbytes);
+        memset(buff + numbytes, 0, num_blocks * 64 - numbytes);
         buff[numbytes] = 0x80;
-        sha1_bytestoword32(wbuff, buff);
-
-        if (numbytes > 64 - 9) {
-            sha1_digest(wbuff, h);
-            memset(buff, 0, 64);
-            sha1_bytestoword32(wbuff, buff);
-        }
-
-        wbuff[14] = state->len_high;
-        wbuff[15] = state->len_low;
-        sha1_digest(wbuff, h);
+        sha1_word32tobytes(len, buff + num_blocks * 64 - 8, 2);
+        sha1_blocks(h, buff, num_blocks);
 
         if (out_max - out < 20)
             out = filter->do_output(filter, out, &out_max);
-        sha1_word32tobytes(h, out);
+        sha1_word32tobytes(h, out, 5);
         filter->buf_out_end = out + 20;
     }
 
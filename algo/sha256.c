@@ -0,0 +1,357 @@
+/* lua-datafilter algorithm: sha256
+ */
+
+#include <stdint.h>
+
+#define rotr(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t
+sha256_K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5,
+    0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC,
+    0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7,
+    0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3,
+    0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5,
+    0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static const uint32_t
+sha256_initial_state[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static void
+sha256_word32tobytes (const uint32_t *input, unsigned char *output,
+                      int num_words)
+{
+    int j = 0;
+    while (j < num_words * 4) {
+        uint32_t v = *input++;
+        output[j++] = v >> 24;
+        output[j++] = (v >> 16) & 0xFF;
+        output[j++] = (v >> 8) & 0xFF;
+        output[j++] = v & 0xFF;
+    }
+}
+
+/* The 64 rounds of the compression function, given the message schedule
+ * with the round constants already added to it. */
+static void
+sha256_rounds (uint32_t *h, const uint32_t *wk) {
+    uint32_t a, b, c, d, e, f, g, hh, t1, t2;
+    int t;
+
+    a = h[0];  b = h[1];  c = h[2];  d = h[3];
+    e = h[4];  f = h[5];  g = h[6];  hh = h[7];
+
+    for (t = 0; t < 64; ++t) {
+        t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) +
+             ((e & f) ^ (~e & g)) + wk[t];
+        t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) +
+             ((a & b) ^ (a & c) ^ (b & c));
+        hh = g;  g = f;  f = e;  e = d + t1;
+        d = c;  c = b;  b = a;  a = t1 + t2;
+    }
+
+    h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;
+    h[4] += e;  h[5] += f;  h[6] += g;  h[7] += hh;
+}
+
+static void
+sha256_digest (uint32_t *h, const unsigned char *in) {
+    uint32_t w[64];
+    int t;
+
+    for (t = 0; t < 16; ++t, in += 4)
+        w[t] = ((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) |
+               ((uint32_t) in[2] << 8) | (uint32_t) in[3];
+    for (; t < 64; ++t)
+        w[t] = (rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10)) +
+               w[t - 7] +
+               (rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3)) +
+               w[t - 16];
+    for (t = 0; t < 64; ++t)
+        w[t] += sha256_K[t];
+
+    sha256_rounds(h, w);
+}
+
+#ifdef DATAFILTER_X86_SIMD
+/* Four rounds with the SHA extensions, using the message words in 'm',
+ * while working ahead on the message schedule: finishing the words for the
+ * rounds after next (mn, which needs the last ones, mp) and starting on
+ * 'mp' for later on, unless 'last' is true because it's not needed. */
+#define SHA256NI_ROUNDS(t, m, mn, mp, last) \
+    msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *) \
+                                           (sha256_K + (t)))); \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg); \
+    mn = _mm_sha256msg2_epu32(_mm_add_epi32(mn, _mm_alignr_epi8(m, mp, 4)), \
+                              m); \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E)); \
+    if (!(last)) \
+        mp = _mm_sha256msg1_epu32(mp, m);
+
+/* The first 16 rounds, where the message words are just loaded. */
+#define SHA256NI_FIRST_ROUNDS(t, m, mp) \
+    m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 4 * (t))), \
+                         byte_swap); \
+    msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *) \
+                                           (sha256_K + (t)))); \
+    cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg); \
+    abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E)); \
+    if (t) \
+        mp = _mm_sha256msg1_epu32(mp, m);
+
+SIMD_TARGET("sha,sse4.1")
+static void
+sha256_blocks_shani (uint32_t *h, const unsigned char *in,
+                     size_t num_blocks)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0C0D0E0F08090A0BLL,
+                                             0x0405060700010203LL);
+    __m128i abef, cdgh, abef_save, cdgh_save, msg, tmp;
+    __m128i msg0, msg1, msg2, msg3;
+
+    /* The instructions want the state split into ABEF and CDGH, with the
+     * first of each in the highest lane. */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) h), 0xB1);
+    cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) (h + 4)),
+                             0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    while (num_blocks--) {
+        abef_save = abef;
+        cdgh_save = cdgh;
+
+        SHA256NI_FIRST_ROUNDS(0, msg0, msg3)
+        SHA256NI_FIRST_ROUNDS(4, msg1, msg0)
+        SHA256NI_FIRST_ROUNDS(8, msg2, msg1)
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + 48)),
+                                byte_swap);
+        SHA256NI_ROUNDS(12, msg3, msg0, msg2, 0)
+        SHA256NI_ROUNDS(16, msg0, msg1, msg3, 0)
+        SHA256NI_ROUNDS(20, msg1, msg2, msg0, 0)
+        SHA256NI_ROUNDS(24, msg2, msg3, msg1, 0)
+        SHA256NI_ROUNDS(28, msg3, msg0, msg2, 0)
+        SHA256NI_ROUNDS(32, msg0, msg1, msg3, 0)
+        SHA256NI_ROUNDS(36, msg1, msg2, msg0, 0)
+        SHA256NI_ROUNDS(40, msg2, msg3, msg1, 0)
+        SHA256NI_ROUNDS(44, msg3, msg0, msg2, 0)
+        SHA256NI_ROUNDS(48, msg0, msg1, msg3, 0)
+        SHA256NI_ROUNDS(52, msg1, msg2, msg0, 1)
+        SHA256NI_ROUNDS(56, msg2, msg3, msg1, 1)
+
+        msg = _mm_add_epi32(msg3, _mm_loadu_si128((const __m128i *)
+                                                  (sha256_K + 60)));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh,
+                                     _mm_shuffle_epi32(msg, 0x0E));
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+        in += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i *) h, _mm_blend_epi16(tmp, cdgh, 0xF0));
+    _mm_storeu_si128((__m128i *) (h + 4), _mm_alignr_epi8(cdgh, tmp, 8));
+}
+
+#undef SHA256NI_FIRST_ROUNDS
+#undef SHA256NI_ROUNDS
+
+/* Without the SHA extensions, the message schedule for two blocks at once
+ * can be worked out with AVX2, one block in each 128 bit half, four words
+ * at a time.  The last two of each four words depend on the first two, so
+ * sigma1 is done in two steps.  The rounds themselves are done the normal
+ * way, since they don't vectorize. */
+#define SHA256X_ROTR(x, n) \
+    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define SHA256X_SIGMA0(x) \
+    _mm256_xor_si256(_mm256_xor_si256(SHA256X_ROTR(x, 7), \
+                                      SHA256X_ROTR(x, 18)), \
+                     _mm256_srli_epi32(x, 3))
+#define SHA256X_SIGMA1(x) \
+    _mm256_xor_si256(_mm256_xor_si256(SHA256X_ROTR(x, 17), \
+                                      SHA256X_ROTR(x, 19)), \
+                     _mm256_srli_epi32(x, 10))
+
+SIMD_TARGET("avx2")
+static void
+sha256_blocks_avx2 (uint32_t *h, const unsigned char *in, size_t num_blocks)
+{
+    const __m256i byte_swap = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i low_half = _mm256_setr_epi32(-1, -1, 0, 0, -1, -1, 0, 0);
+    uint32_t wk[2][64];
+    __m256i w[16], x;
+    const unsigned char *second;
+    int t;
+
+    while (num_blocks > 0) {
+        /* With an odd number of blocks, the last one is done twice. */
+        second = num_blocks > 1 ? in + 64 : in;
+        for (t = 0; t < 4; ++t) {
+            x = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *) (in + 16 * t))),
+                _mm_loadu_si128((const __m128i *) (second + 16 * t)), 1);
+            w[t] = _mm256_shuffle_epi8(x, byte_swap);
+        }
+
+        for (t = 4; t < 16; ++t) {
+            /* w[t - 4] covers words 4t-16 to 4t-13, and so on. */
+            x = _mm256_add_epi32(
+                _mm256_add_epi32(w[t - 4],
+                                 SHA256X_SIGMA0(_mm256_alignr_epi8(w[t - 3],
+                                                                   w[t - 4],
+                                                                   4))),
+                _mm256_alignr_epi8(w[t - 1], w[t - 2], 4));
+            x = _mm256_add_epi32(x, _mm256_and_si256(
+                SHA256X_SIGMA1(_mm256_shuffle_epi32(w[t - 1], 0x0E)),
+                low_half));
+            w[t] = _mm256_add_epi32(x, _mm256_andnot_si256(
+                low_half, SHA256X_SIGMA1(_mm256_shuffle_epi32(x, 0x40))));
+        }
+
+        for (t = 0; t < 16; ++t) {
+            x = _mm256_add_epi32(w[t], _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i *) (sha256_K + 4 * t))));
+            _mm_storeu_si128((__m128i *) (wk[0] + 4 * t),
+                             _mm256_castsi256_si128(x));
+            _mm_storeu_si128((__m128i *) (wk[1] + 4 * t),
+                             _mm256_extracti128_si256(x, 1));
+        }
+
+        sha256_rounds(h, wk[0]);
+        if (num_blocks == 1)
+            break;
+        sha256_rounds(h, wk[1]);
+        in += 128;
+        num_blocks -= 2;
+    }
+}
+
+#undef SHA256X_SIGMA1
+#undef SHA256X_SIGMA0
+#undef SHA256X_ROTR
+#endif
+
+/* Run the compression function over some whole 64 byte blocks. */
+static void
+sha256_blocks (uint32_t *h, const unsigned char *in, size_t num_blocks) {
+#ifdef DATAFILTER_X86_SIMD
+    if (cpu_has.sha) {
+        sha256_blocks_shani(h, in, num_blocks);
+        return;
+    }
+    if (cpu_has.avx2) {
+        sha256_blocks_avx2(h, in, num_blocks);
+        return;
+    }
+#endif
+
+    while (num_blocks--) {
+        sha256_digest(h, in);
+        in += 64;
+    }
+}
+
+typedef struct SHA256State_ {
+    uint32_t h[8];
+    uint64_t len;       /* in bits, of the input processed so far */
+} SHA256State;
+
+static int
+algo_sha256_init (Filter *filter, int options_pos) {
+    SHA256State *state = ALGO_STATE(filter);
+    (void) options_pos;     /* unused */
+
+    memcpy(state->h, sha256_initial_state, sizeof(sha256_initial_state));
+    state->len = 0;
+    return 1;
+}
+
+static size_t
+algo_sha256_size (Filter *filter, size_t input_size) {
+    (void) filter;          /* unused */
+    (void) input_size;      /* unused */
+    return 32;
+}
+
+static size_t
+algo_sha256_export_state (Filter *filter, uint32_t *words) {
+    SHA256State *state = ALGO_STATE(filter);
+    memcpy(words, state->h, 8 * sizeof(uint32_t));
+    words[8] = (uint32_t) (state->len & 0xFFFFFFFF);
+    words[9] = (uint32_t) (state->len >> 32);
+    return 10;
+}
+
+static int
+algo_sha256_import_state (Filter *filter, const uint32_t *words,
+                          size_t num_words)
+{
+    SHA256State *state = ALGO_STATE(filter);
+
+    /* Only whole blocks are counted until the end of the input. */
+    if (num_words != 10 || (words[8] & 511) != 0)
+        return 0;
+    memcpy(state->h, words, 8 * sizeof(uint32_t));
+    state->len = ((uint64_t) words[9] << 32) | words[8];
+    return 1;
+}
+
+static const unsigned char *
+algo_sha256 (Filter *filter,
+             const unsigned char *in, const unsigned char *in_end,
+             unsigned char *out, unsigned char *out_max, int eof)
+{
+    SHA256State *state = ALGO_STATE(filter);
+    unsigned char buff[128];
+    size_t num_blocks = (in_end - in) / 64;
+    uint32_t len[2];
+    int numbytes;
+
+    sha256_blocks(state->h, in, num_blocks);
+    in += num_blocks * 64;
+    state->len += (uint64_t) num_blocks * 512;
+
+    if (eof) {
+        /* Pad to one or two blocks, with the length at the end. */
+        numbytes = in_end - in;
+        state->len += (uint64_t) numbytes * 8;
+        len[0] = (uint32_t) (state->len >> 32);
+        len[1] = (uint32_t) (state->len & 0xFFFFFFFF);
+        num_blocks = numbytes > 64 - 9 ? 2 : 1;
+        memcpy(buff, in, numbytes);
+        in += numbytes;
+        memset(buff + numbytes, 0, num_blocks * 64 - numbytes);
+        buff[numbytes] = 0x80;
+        sha256_word32tobytes(len, buff + num_blocks * 64 - 8, 2);
+        sha256_blocks(state->h, buff, num_blocks);
+
+        if (out_max - out < 32)
+            out = filter->do_output(filter, out, &out_max);
+        sha256_word32tobytes(state->h, out, 8);
+        filter->buf_out_end = out + 32;
+    }
+
+    return in;
+}
+
+#undef rotr
@@ -19,9 +19,10 @@ while (<$input_fh>) {
     chomp;
     s/#.*//;
     next unless /\S/;
-    my ($name, $struct, $destructor) = split ' ', $_;
+    my ($name, $struct, $destructor, $size_func, $chunks, $exportable) =
+        split ' ', $_;
     die "$input_filename:$.: bad line '$_'\n"
-        unless defined $destructor;
+        unless defined $exportable;
     my $has_init_method = $struct ne '-';
     my $struct_size = $struct eq '-' ? 0 : "sizeof(${struct}State)";
     push @algo, {
@@ -29,6 +30,12 @@ while (<$input_fh>) {
         struct_size => $struct_size,
         init_method => ($has_init_method ? "algo_${name}_init" : 0),
         destroy_method => ($destructor ? "algo_${name}_destroy" : 0),
+        clone_method => ($destructor ? "algo_${name}_clone" : 0),
+        size_func => ($size_func ? "algo_${name}_size" : 0),
+        chunk_align => ($chunks ? "algo_${name}_chunk_align" : 0),
+        chunk_size => ($chunks ? "algo_${name}_chunk_size" : 0),
+        export_state => ($exportable ? "algo_${name}_export_state" : 0),
+        import_state => ($exportable ? "algo_${name}_import_state" : 0),
         index => $index++,
     };
 }
@@ -51,9 +58,11 @@ print $out_fh "\nstatic const AlgorithmDefinition\n",
               "filter_algorithms[] = {\n";
 for (@algo) {
     print $out_fh "    { \"$_->{name}\", algo_$_->{name},",
-                  " algowrap_$_->{name},\n",
+                  " algowrap_$_->{name}, $_->{size_func},\n",
                   "      $_->{struct_size}, $_->{init_method},",
-                  " $_->{destroy_method} },\n";
+                  " $_->{destroy_method}, $_->{clone_method},\n",
+                  "      $_->{chunk_align}, $_->{chunk_size},\n",
+                  "      $_->{export_state}, $_->{import_state} },\n";
 }
 print $out_fh "};\n",
               "#define NUM_ALGO_DEFS (sizeof(filter_algorithms) /",
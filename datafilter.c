@@ -1,13 +1,59 @@
+/* Needed for mmap() and friends, which are used for reading files when
+ * they're available. */
+#define _POSIX_C_SOURCE 200112L
+
 #include "datafilter.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <ctype.h>
 #include <errno.h>
 #include <assert.h>
 
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define DATAFILTER_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* How much of a file to map into memory at a time. */
+#define MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+#endif
+
+/* Threads are used for splitting up big inputs to the simple functions,
+ * when asked for with the 'threads' option.  Define DATAFILTER_NO_THREADS
+ * to do everything in the calling thread. */
+#if !defined(DATAFILTER_NO_THREADS) && \
+    defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+#define DATAFILTER_THREADS
+#include <pthread.h>
+
+/* Async mode also needs atomic variables, for which the GCC builtins are
+ * used, since they aren't part of C99. */
+#ifdef __GNUC__
+#define DATAFILTER_ASYNC
+#endif
+#endif
+#endif
+
+/* The SIMD versions of some algorithms are only built for x86 processors
+ * with a GCC-compatible compiler, which lets individual functions be compiled
+ * for instruction sets that the rest of the library can't assume.  Which ones
+ * actually get used is decided at runtime, by detect_cpu_features().
+ * Define DATAFILTER_NO_SIMD to leave them out altogether. */
+#if !defined(DATAFILTER_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define DATAFILTER_X86_SIMD
+#include <immintrin.h>
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 #define FILTER_MT_NAME ("c3966aca-6037-11dc-9675-00e081225ce5-" VERSION)
 
 struct Filter_;
+struct AsyncInput_;
 typedef const unsigned char * (*AlgorithmFunction)
     (struct Filter_ *filter,
      const unsigned char *in, const unsigned char *in_end,
@@ -16,6 +62,16 @@ typedef unsigned char * (*FilterOutputFunc)
     (struct Filter_ *filter, const unsigned char *out_end,
      unsigned char **out_max);
 typedef void (*AlgorithmDestroyFunction) (struct Filter_ *filter);
+typedef void (*AlgorithmCloneFunction) (struct Filter_ *filter);
+typedef size_t (*AlgorithmSizeFunction) (struct Filter_ *filter,
+                                         size_t input_size);
+typedef size_t (*AlgorithmChunkAlignFunction) (struct Filter_ *filter);
+typedef size_t (*AlgorithmExportStateFunction) (struct Filter_ *filter,
+                                                uint32_t *words);
+typedef int (*AlgorithmImportStateFunction)
+    (struct Filter_ *filter, const uint32_t *words, size_t num_words);
+typedef size_t (*AlgorithmChunkSizeFunction)
+    (struct Filter_ *filter, const unsigned char *in, size_t len);
 
 typedef struct Filter_ {
     size_t filter_object_size;
@@ -26,37 +82,192 @@ typedef struct Filter_ {
     unsigned char *buf_in, *buf_in_end, *buf_out, *buf_out_end;
     size_t buf_in_size, buf_out_size;
     int buf_in_free;    /* true if it should be deallocated on destruction */
+    int buf_auto_size;  /* true if buffers can grow, see output_flushed() */
+    unsigned int buf_in_fills, buf_out_flushes;
     AlgorithmFunction func;
     FilterOutputFunc do_output;
     AlgorithmDestroyFunction destroy_func;
+    AlgorithmCloneFunction clone_func;
+    AlgorithmSizeFunction size_func;
     int finished;
     FILE *c_fh;
     int output_func_ref, l_fh_ref;
+    struct Filter_ *next_stage;     /* next filter in a pipeline, or null */
+    int is_tee;     /* true if the following filters are branches of a tee */
+    const char *algo_name;
+    const char *error;  /* from ALGO_ERROR, when there's no Lua state */
+    int async_option;
+    size_t async_size;              /* size of ring buffer for async mode */
+    struct AsyncInput_ *async;      /* background thread, or null */
 } Filter;
 
 #define ALGO_STATE(filter) ((void *) (((char *) (filter)) + sizeof(Filter)))
 
+/* In a filter object each stage's state is followed by a copy of it as it
+ * was just after initialization, which reset() puts back. */
+#define ALGO_INITIAL_STATE(filter) \
+    ((void *) (((char *) (filter)) + (filter)->filter_object_size))
+
 typedef int (*AlgorithmWrapperFunction) (lua_State *L);
-/*typedef size_t (*AlgorithmSizeFunction) (size_t input_size);*/
 typedef int (*AlgorithmInitFunction) (Filter *filter, int options_pos);
 
 typedef struct AlgorithmDefinition_ {
     const char *name;
     AlgorithmFunction func;
     AlgorithmWrapperFunction wrapper_func;
-    /*AlgorithmSizeFunction size_func;*/
+    AlgorithmSizeFunction size_func;    /* expected output size, or 0 */
     size_t state_size;
     AlgorithmInitFunction init_func;
     AlgorithmDestroyFunction destroy_func;
+
+    /* Called on a copy of a filter object made by clone(), to make its own
+     * copies of anything destroy_func() would free, in both the state and
+     * the initial state. */
+    AlgorithmCloneFunction clone_func;
+
+    /* For algorithms which can process pieces of a big input separately,
+     * each starting with a copy of the newly initialized state.  The pieces
+     * must be a multiple of the size returned by chunk_align(), or it can
+     * return zero if the input can't be split with the options given.
+     * chunk_size() returns exactly how much output a piece will produce, or
+     * (size_t) -1 if the piece can't be processed by itself after all. */
+    AlgorithmChunkAlignFunction chunk_align;
+    AlgorithmChunkSizeFunction chunk_size;
+
+    /* For algorithms whose state can be saved by export_state() and loaded
+     * into a new filter by import_state().  The state is converted to and
+     * from at most FILTER_STATE_MAX_WORDS 32 bit numbers, so that it doesn't
+     * depend on the layout of the struct.  The import function returns
+     * false if the numbers don't make sense. */
+    AlgorithmExportStateFunction export_state;
+    AlgorithmImportStateFunction import_state;
 } AlgorithmDefinition;
 
+/* For hashing several independent messages at once, as md5_many() and
+ * sha1_many() do.  The function processes one 64 byte block for each lane
+ * flagged in 'active', updating a state which is laid out with all the
+ * lanes' values for the first word of the digest, then the second, etc. */
+#define MULTIBUF_MAX_LANES 8
+typedef void (*MultiBufBlockFunction)
+    (uint32_t *state, const unsigned char *const *blocks,
+     unsigned int active);
+
+typedef struct MultiBufHash_ {
+    MultiBufBlockFunction func;
+    int num_lanes;
+    int digest_words;
+    int big_endian;     /* for the digest words and message length */
+    const uint32_t *initial_state;
+} MultiBufHash;
+
+#ifdef DATAFILTER_X86_SIMD
+/* Load the next 16 bytes of each of four lanes' blocks, transposed so that
+ * each vector holds the same (little endian) word from all the lanes. */
+#define MULTIBUF_TRANSPOSE(m, r0, r1, r2, r3, UNPACKLO32, UNPACKHI32, \
+                           UNPACKLO64, UNPACKHI64) \
+    t0 = UNPACKLO32(r0, r1);  t1 = UNPACKLO32(r2, r3); \
+    t2 = UNPACKHI32(r0, r1);  t3 = UNPACKHI32(r2, r3); \
+    (m)[0] = UNPACKLO64(t0, t1);  (m)[1] = UNPACKHI64(t0, t1); \
+    (m)[2] = UNPACKLO64(t2, t3);  (m)[3] = UNPACKHI64(t2, t3);
+
+SIMD_TARGET("sse2")
+static void
+multibuf_load_x4_sse2 (__m128i *m, const unsigned char *const *blocks) {
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+    int i;
+    for (i = 0; i < 64; i += 16, m += 4) {
+        r0 = _mm_loadu_si128((const __m128i *) (blocks[0] + i));
+        r1 = _mm_loadu_si128((const __m128i *) (blocks[1] + i));
+        r2 = _mm_loadu_si128((const __m128i *) (blocks[2] + i));
+        r3 = _mm_loadu_si128((const __m128i *) (blocks[3] + i));
+        MULTIBUF_TRANSPOSE(m, r0, r1, r2, r3, _mm_unpacklo_epi32,
+                           _mm_unpackhi_epi32, _mm_unpacklo_epi64,
+                           _mm_unpackhi_epi64)
+    }
+}
+
+/* The same for eight lanes, with lanes 4 to 7 in the upper halves. */
+SIMD_TARGET("avx2")
+static void
+multibuf_load_x8_avx2 (__m256i *m, const unsigned char *const *blocks) {
+    __m256i r0, r1, r2, r3, t0, t1, t2, t3;
+    int i;
+#define MULTIBUF_LOAD_PAIR(lane) \
+    _mm256_inserti128_si256(_mm256_castsi128_si256( \
+        _mm_loadu_si128((const __m128i *) (blocks[lane] + i))), \
+        _mm_loadu_si128((const __m128i *) (blocks[(lane) + 4] + i)), 1)
+    for (i = 0; i < 64; i += 16, m += 4) {
+        r0 = MULTIBUF_LOAD_PAIR(0);
+        r1 = MULTIBUF_LOAD_PAIR(1);
+        r2 = MULTIBUF_LOAD_PAIR(2);
+        r3 = MULTIBUF_LOAD_PAIR(3);
+        MULTIBUF_TRANSPOSE(m, r0, r1, r2, r3, _mm256_unpacklo_epi32,
+                           _mm256_unpackhi_epi32, _mm256_unpacklo_epi64,
+                           _mm256_unpackhi_epi64)
+    }
+#undef MULTIBUF_LOAD_PAIR
+}
+
+#undef MULTIBUF_TRANSPOSE
+
+/* All ones in the lanes whose bits are set in 'active'. */
+SIMD_TARGET("sse2")
+static __m128i
+multibuf_mask_x4_sse2 (unsigned int active) {
+    const __m128i bits = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(active), bits), bits);
+}
+
+SIMD_TARGET("avx2")
+static __m256i
+multibuf_mask_x8_avx2 (unsigned int active) {
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(active),
+                                               bits), bits);
+}
+#endif
+
 static const unsigned char default_line_ending[] = { 13, 10 };
 
 #define EMAIL_MAX_LINE_LENGTH 76
 
+/* Limits on the buffer sizes which can be set with options.  The minimum
+ * leaves enough room for the algorithms which need to keep some input or
+ * output together, like the QP line length tolerance. */
+#define FILTER_MIN_BUFFER_SIZE 1024
+#define FILTER_MAX_BUFFER_SIZE (256 * 1024 * 1024)
+
+/* When the buffer sizes aren't set with options they start at BUFSIZ, but
+ * are doubled each time they've been filled this many times, up to the
+ * maximum given here. */
+#define FILTER_AUTO_BUFFER_GROW_AFTER 4
+#define FILTER_AUTO_BUFFER_MAX (1024 * 1024)
+
+/* When the simple functions are allowed to use more than one thread, each
+ * thread is given at least this much of the input to work on, so smaller
+ * inputs are done the normal way. */
+#define FILTER_MAX_THREADS 64
+#define FILTER_THREAD_MIN_INPUT (256 * 1024)
+
+/* Size of the ring buffer used in async mode, if not set with an option. */
+#define FILTER_ASYNC_DEFAULT_SIZE (4 * 1024 * 1024)
+
+/* The data returned by export_state() starts with these bytes and a format
+ * version number, followed by the length and name of the algorithm, the
+ * number of words of state and the words themselves, and finally the length
+ * of any input which hasn't been processed yet, and the input itself.
+ * Numbers of more than one byte are stored big-endian. */
+#define FILTER_STATE_MAGIC "DFS"
+#define FILTER_STATE_VERSION 1
+#define FILTER_STATE_MAX_WORDS 32
+
 #define my_ishex(c) (((c) >= 48 && (c) <= 57) || \
                      ((c) >= 65 && (c) <= 70) || \
                      ((c) >= 97 && (c) <= 102))
+/* Define this myself so that it's not locale dependent.  Also it doesn't
+ * allow vertical tabs as whitespace, because nobody uses them. */
+#define my_isspace(c) ((c) == 32 || (c) == 10 || (c) == 13 || (c) == 9 || \
+                       (c) == 12)
 #define hex_digit_val(c) ((c) >= 48 && (c) <= 57 ? ((c) - 48) \
                         : (c) >= 65 && (c) <= 70 ? ((c) - 55) \
                                                  : ((c) - 87))
@@ -91,6 +302,28 @@ hex_char_value[] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,   /* 240 */
 };
 
+#ifdef DATAFILTER_X86_SIMD
+/* Instruction set extensions which the SIMD code can use. */
+static struct {
+    int sse2, ssse3, avx2, sha, pclmul, sse42;
+} cpu_has;
+#endif
+
+static void
+detect_cpu_features (void) {
+#ifdef DATAFILTER_X86_SIMD
+    __builtin_cpu_init();
+    cpu_has.sse2 = __builtin_cpu_supports("sse2");
+    cpu_has.ssse3 = __builtin_cpu_supports("ssse3");
+    cpu_has.avx2 = __builtin_cpu_supports("avx2");
+    cpu_has.sha = __builtin_cpu_supports("sha") &&
+                  __builtin_cpu_supports("sse4.1");
+    cpu_has.pclmul = __builtin_cpu_supports("pclmul") &&
+                     __builtin_cpu_supports("sse4.1");
+    cpu_has.sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
 static const unsigned char *
 my_strduplen (Filter *filter, const unsigned char *s, size_t len) {
     unsigned char *newstr = filter->alloc(filter->alloc_ud, 0, 0, len);
@@ -99,15 +332,75 @@ my_strduplen (Filter *filter, const unsigned char *s, size_t len) {
     return newstr;
 }
 
+/* Read one of the buffer size options, leaving 'size' alone if it's not
+ * there.  Returns false with an error message on the stack if it's no good. */
 static int
-init_filter (Filter *filter, lua_State *L, const AlgorithmDefinition *def,
-             int options_pos)
+get_buffer_size_option (lua_State *L, int options_pos, const char *name,
+                        size_t *size)
+{
+    lua_Number n;
+
+    lua_getfield(L, options_pos, name);
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isnumber(L, -1)) {
+            lua_pushfstring(L, "bad value for '%s' option, should be a"
+                            " number", name);
+            return 0;
+        }
+        n = lua_tonumber(L, -1);
+        if (!(n >= FILTER_MIN_BUFFER_SIZE && n <= FILTER_MAX_BUFFER_SIZE)) {
+            lua_pushfstring(L, "bad value for '%s' option, must be between"
+                            " %d and %d", name, FILTER_MIN_BUFFER_SIZE,
+                            FILTER_MAX_BUFFER_SIZE);
+            return 0;
+        }
+        *size = n;
+    }
+    lua_pop(L, 1);
+
+    return 1;
+}
+
+/* Filters which do their work in other threads, for hash_files() or in
+ * async mode, allocate memory with this instead of the Lua allocator,
+ * which might not be thread safe. */
+static void *
+system_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void) ud;
+    (void) osize;
+    if (nsize == 0) {
+        free(ptr);
+        return 0;
+    }
+    return realloc(ptr, nsize);
+}
+
+/* Set up a filter and its algorithm's state, but not the output buffer,
+ * which is left to the caller. */
+static int
+init_filter_state (Filter *filter, lua_State *L,
+                   const AlgorithmDefinition *def, int options_pos)
 {
     lua_Alloc alloc;
     void *alloc_ud;
-    int stacktop;
-
-    alloc = lua_getallocf(L, &alloc_ud);
+    int stacktop, ok;
+    size_t buf_size = 0, buf_in_size = 0, buf_out_size = 0;
+
+    /* In async mode the filter's memory is used by another thread. */
+    filter->async_option = 0;
+    filter->async_size = 0;
+    filter->async = 0;
+    if (options_pos) {
+        lua_getfield(L, options_pos, "async");
+        filter->async_option = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+    if (filter->async_option) {
+        alloc = system_alloc;
+        alloc_ud = 0;
+    }
+    else
+        alloc = lua_getallocf(L, &alloc_ud);
 
     filter->filter_object_size = sizeof(Filter) + def->state_size;
     filter->L = L;
@@ -117,21 +410,36 @@ init_filter (Filter *filter, lua_State *L, const AlgorithmDefinition *def,
     filter->c_fh = 0;
     filter->output_func_ref = LUA_NOREF;
     filter->l_fh_ref = LUA_NOREF;
+    filter->next_stage = 0;
+    filter->is_tee = 0;
+    filter->algo_name = def->name;
+    filter->error = 0;
 
-    filter->buf_out = filter->buf_in = 0;
+    filter->buf_out = filter->buf_out_end = filter->buf_in = 0;
+    filter->buf_out_size = 0;
     filter->buf_in_free = 0;
     filter->lbuf = 0;
     filter->destroy_func = 0;
-
-    filter->buf_out = filter->buf_out_end = alloc(alloc_ud, 0, 0, BUFSIZ);
-    assert(filter->buf_out);
-    filter->buf_out_size = BUFSIZ;
-
-    filter->destroy_func = def->destroy_func;
+    filter->clone_func = def->clone_func;
+    filter->size_func = def->size_func;
     filter->func = def->func;
 
+    /* The buffer size options apply to all algorithms, so are dealt with
+     * here, before the algorithm's own options. */
     stacktop = lua_gettop(L);
-    if (def->init_func && !def->init_func(filter, options_pos)) {
+    ok = !options_pos ||
+         (get_buffer_size_option(L, options_pos, "buffer_size", &buf_size) &&
+          get_buffer_size_option(L, options_pos, "input_buffer_size",
+                                 &buf_in_size) &&
+          get_buffer_size_option(L, options_pos, "output_buffer_size",
+                                 &buf_out_size));
+    if (ok) {
+        /* The destroy function can only be trusted with the state once the
+         * init function has had a go at it, even if that failed part way. */
+        filter->destroy_func = def->destroy_func;
+        ok = !def->init_func || def->init_func(filter, options_pos);
+    }
+    if (!ok) {
         /* There was an error initializing the object.  Should be an error
          * message on the top of the stack, but the init function might have
          * left other stuff below that, so tidy it away. */
@@ -141,33 +449,78 @@ init_filter (Filter *filter, lua_State *L, const AlgorithmDefinition *def,
         return 0;
     }
 
+    /* Buffers which aren't given a size start at a reasonable default, and
+     * can grow later if there's a lot of data going through them. */
+    filter->buf_auto_size = !buf_size && !buf_in_size && !buf_out_size;
+    filter->buf_in_fills = filter->buf_out_flushes = 0;
+    if (!buf_size)
+        buf_size = BUFSIZ;
+    filter->buf_in_size = buf_in_size ? buf_in_size : buf_size;
+    filter->buf_out_size = buf_out_size ? buf_out_size : buf_size;
+
+    return 1;
+}
+
+static int
+init_filter (Filter *filter, lua_State *L, const AlgorithmDefinition *def,
+             int options_pos)
+{
+    if (!init_filter_state(filter, L, def, options_pos))
+        return 0;
+
+    filter->buf_out = filter->buf_out_end = filter->alloc(
+        filter->alloc_ud, 0, 0, filter->buf_out_size);
+    assert(filter->buf_out);
+
     return 1;
 }
 
 static void
 filter_cleanup (lua_State *L, Filter *filter) {
-    if (filter->c_fh) {
-        if (fclose(filter->c_fh))
-            luaL_error(L, "error closing output file handle: %s",
-                       strerror(errno));
-        filter->c_fh = 0;
+    for (; filter; filter = filter->next_stage) {
+        if (filter->c_fh) {
+            if (fclose(filter->c_fh))
+                luaL_error(L, "error closing output file handle: %s",
+                           strerror(errno));
+            filter->c_fh = 0;
+        }
+
+        luaL_unref(L, LUA_REGISTRYINDEX, filter->output_func_ref);
+        filter->output_func_ref = LUA_NOREF;
+        luaL_unref(L, LUA_REGISTRYINDEX, filter->l_fh_ref);
+        filter->l_fh_ref = LUA_NOREF;
     }
+}
 
-    luaL_unref(L, LUA_REGISTRYINDEX, filter->output_func_ref);
-    filter->output_func_ref = LUA_NOREF;
-    luaL_unref(L, LUA_REGISTRYINDEX, filter->l_fh_ref);
-    filter->l_fh_ref = LUA_NOREF;
+/* The stage of a pipeline which sends its output to the real destination.
+ * For a filter which isn't a pipeline, that's just the filter itself. */
+static Filter *
+last_stage (Filter *filter) {
+    while (filter->next_stage)
+        filter = filter->next_stage;
+    return filter;
 }
 
+static unsigned char *
+output_string (Filter *filter, const unsigned char *out_end,
+               unsigned char **out_max);
+
 static void
 filter_finished_cleanup (lua_State *L, Filter *filter) {
     unsigned char *out_max;
-
-    filter->finished = 1;
-
-    out_max = filter->buf_out + filter->buf_out_size;
-    if (filter->buf_out_end != filter->buf_out)
-        filter->do_output(filter, filter->buf_out_end, &out_max);
+    Filter *stage;
+
+    /* The stages of a pipeline are flushed in order, so that anything
+     * passed on to the next stage gets flushed along with it. */
+    for (stage = filter; stage; stage = stage->next_stage) {
+        stage->finished = 1;
+
+        /* Output collected as a string stays where it is. */
+        out_max = stage->buf_out + stage->buf_out_size;
+        if (stage->buf_out_end != stage->buf_out &&
+            stage->do_output != output_string)
+            stage->do_output(stage, stage->buf_out_end, &out_max);
+    }
 
     filter_cleanup(L, filter);
 }
@@ -182,9 +535,13 @@ add_input_data (Filter *filter, const unsigned char *data, size_t len) {
 
 /* This can be used by algorithms to report an error.  They should never
  * throw an exception directly because do_filtering() needs to be able to
- * do cleanup first. */
+ * do cleanup first.  Filters running in other threads have no Lua state,
+ * so the message is left in the filter instead. */
 #define ALGO_ERROR(msg) do { \
-    lua_pushliteral(filter->L, msg); \
+    if (filter->L) \
+        lua_pushliteral(filter->L, msg); \
+    else \
+        filter->error = msg; \
     return 0; \
 } while (0)
 
@@ -215,34 +572,212 @@ do_filtering (Filter *filter, int eof) {
     return 0;
 }
 
+/* Feed some more input to the algorithm, without copying it into the input
+ * buffer first unless it has to.  Anything left over from before is topped
+ * up from the new data and processed first.  Then the algorithm is run
+ * directly on the rest of the caller's data, and only the bit it can't deal
+ * with yet (usually a partial block or escape sequence) is copied into the
+ * buffer for next time.  Returns true if there's an error, with the
+ * message on the Lua stack, as for do_filtering(). */
+static int
+filter_input (Filter *filter, const unsigned char *s, size_t len) {
+    const unsigned char *s_end = s + len, *left_over;
+    size_t max_bytes, load_bytes, bytes_left_over;
+
+    while (s < s_end) {
+        if (filter->buf_in_end == filter->buf_in) {
+            left_over = filter->func(filter, s, s_end, filter->buf_out_end,
+                                     filter->buf_out + filter->buf_out_size,
+                                     0);
+            if (!left_over)
+                return 1;
+            if ((size_t) (s_end - left_over) <= filter->buf_in_size) {
+                add_input_data(filter, left_over, s_end - left_over);
+                return 0;
+            }
+            s = left_over;  /* too much left to buffer, do it bit by bit */
+        }
+
+        /* Top up the input buffer with as much as we can fit in. */
+        max_bytes = filter->buf_in_size - (filter->buf_in_end - filter->buf_in);
+        load_bytes = s_end - s;
+        if (load_bytes > max_bytes)
+            load_bytes = max_bytes;
+        assert(load_bytes > 0);
+
+        add_input_data(filter, s, load_bytes);
+        s += load_bytes;
+        if (do_filtering(filter, 0))
+            return 1;
+
+        /* If what's left in the buffer is all new data then it's still
+         * available in the caller's memory, so go back to using that. */
+        bytes_left_over = filter->buf_in_end - filter->buf_in;
+        if (bytes_left_over < load_bytes) {
+            s -= bytes_left_over;
+            filter->buf_in_end = filter->buf_in;
+        }
+    }
+
+    return 0;
+}
+
+/* The stages of a pipeline are stored one after another in the same
+ * userdata, each rounded up to this many bytes to keep them aligned.  The
+ * same goes for the copies of a filter used by filter_in_threads(), which
+ * don't need room for the initial state. */
+#define FILTER_STAGE_ALIGN 16
+
+static size_t
+filter_stage_size (const AlgorithmDefinition *def, int with_initial_state) {
+    size_t size = sizeof(Filter) + def->state_size;
+    if (with_initial_state)
+        size += def->state_size;
+    return (size + FILTER_STAGE_ALIGN - 1) / FILTER_STAGE_ALIGN *
+           FILTER_STAGE_ALIGN;
+}
+
+/* The algorithm function for a filter created by new_tee(), which gives a
+ * copy of its input to each of the filters following it.  Big inputs are
+ * handed out a piece at a time, so that each piece is still in the cache
+ * when the next algorithm gets to it. */
+#define TEE_CHUNK_SIZE (16 * 1024)
+
+static const unsigned char *
+tee_filter (Filter *filter, const unsigned char *in,
+            const unsigned char *in_end, unsigned char *out,
+            unsigned char *out_max, int eof)
+{
+    const unsigned char *chunk_end;
+    Filter *branch;
+    (void) out;
+    (void) out_max;
+
+    while (in < in_end) {
+        chunk_end = in_end - in > TEE_CHUNK_SIZE ? in + TEE_CHUNK_SIZE : in_end;
+        for (branch = filter->next_stage; branch; branch = branch->next_stage)
+            if (filter_input(branch, in, chunk_end - in))
+                return 0;
+        in = chunk_end;
+    }
+
+    if (eof) {
+        for (branch = filter->next_stage; branch; branch = branch->next_stage)
+            if (do_filtering(branch, 1))
+                return 0;
+    }
+
+    return in_end;
+}
+
+static const AlgorithmDefinition tee_algorithm = {
+    "tee", tee_filter, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* Process the end of the input.  In a pipeline each stage is finished in
+ * turn, and whatever output it has left is passed on to the next stage
+ * before that one is finished too.  The branches of a tee are finished by
+ * tee_filter() itself. */
+static int
+finish_filtering (Filter *filter) {
+    Filter *next;
+
+    for (; filter; filter = next) {
+        if (do_filtering(filter, 1))
+            return 1;
+        if (filter->is_tee)
+            break;
+
+        next = filter->next_stage;
+        if (next && filter->buf_out_end != filter->buf_out) {
+            if (filter_input(next, filter->buf_out,
+                             filter->buf_out_end - filter->buf_out))
+                return 1;
+            filter->buf_out_end = filter->buf_out;
+        }
+    }
+
+    return 0;
+}
+
 static void
 destroy_filter (lua_State *L, Filter *filter) {
     if (!filter->finished)
         filter_finished_cleanup(L, filter);
 
-    if (filter->destroy_func)
-        filter->destroy_func(filter);
-    filter->destroy_func = 0;
-    if (filter->lbuf)
-        filter->alloc(filter->alloc_ud, filter->lbuf, sizeof(luaL_Buffer), 0);
-    filter->lbuf = 0;
-    if (filter->buf_in_free)
-        filter->alloc(filter->alloc_ud, filter->buf_in, filter->buf_in_size, 0);
-    filter->buf_in = 0;
-    filter->alloc(filter->alloc_ud, filter->buf_out, filter->buf_out_size, 0);
-    filter->buf_out = 0;
+    for (; filter; filter = filter->next_stage) {
+        if (filter->destroy_func)
+            filter->destroy_func(filter);
+        filter->destroy_func = 0;
+        if (filter->lbuf)
+            filter->alloc(filter->alloc_ud, filter->lbuf, sizeof(luaL_Buffer),
+                          0);
+        filter->lbuf = 0;
+        if (filter->buf_in_free)
+            filter->alloc(filter->alloc_ud, filter->buf_in,
+                          filter->buf_in_size, 0);
+        filter->buf_in = 0;
+        filter->alloc(filter->alloc_ud, filter->buf_out, filter->buf_out_size,
+                      0);
+        filter->buf_out = 0;
+    }
+}
+
+/* Called by the output functions which pass the output on somewhere else,
+ * once the buffer is empty again.  If the buffer size is being chosen
+ * automatically, then after it has been filled a few times it is doubled,
+ * so that a filter producing a lot of output passes it on in fewer and
+ * bigger chunks. */
+static unsigned char *
+output_flushed (Filter *filter, unsigned char **out_max) {
+    size_t new_size = filter->buf_out_size * 2;
+
+    if (filter->buf_auto_size && new_size <= FILTER_AUTO_BUFFER_MAX &&
+        ++filter->buf_out_flushes >= FILTER_AUTO_BUFFER_GROW_AFTER)
+    {
+        /* Nothing in it to keep, so don't bother reallocating. */
+        filter->alloc(filter->alloc_ud, filter->buf_out, filter->buf_out_size,
+                      0);
+        filter->buf_out = filter->alloc(filter->alloc_ud, 0, 0, new_size);
+        assert(filter->buf_out);
+        filter->buf_out_size = new_size;
+        filter->buf_out_flushes = 0;
+        *out_max = filter->buf_out + new_size;
+    }
+
+    return filter->buf_out_end = filter->buf_out;
+}
+
+/* The same for the input buffer, called when it has been filled from a
+ * file.  It has to be reallocated, because it might have some data left
+ * over in it. */
+static void
+input_filled (Filter *filter) {
+    size_t new_size = filter->buf_in_size * 2;
+    size_t used = filter->buf_in_end - filter->buf_in;
+
+    if (filter->buf_auto_size && filter->buf_in_free &&
+        new_size <= FILTER_AUTO_BUFFER_MAX &&
+        ++filter->buf_in_fills >= FILTER_AUTO_BUFFER_GROW_AFTER)
+    {
+        filter->buf_in = filter->alloc(filter->alloc_ud, filter->buf_in,
+                                       filter->buf_in_size, new_size);
+        assert(filter->buf_in);
+        filter->buf_in_end = filter->buf_in + used;
+        filter->buf_in_size = new_size;
+        filter->buf_in_fills = 0;
+    }
 }
 
 static unsigned char *
 output_lbuf (Filter *filter, const unsigned char *out_end,
              unsigned char **out_max)
 {
-    (void) out_max;     /* unused - it never changes */
     assert(out_end > filter->buf_out);
     assert(out_end >= filter->buf_out_end);
     luaL_addlstring(filter->lbuf, (const char *) filter->buf_out,
                     out_end - filter->buf_out);
-    return filter->buf_out_end = filter->buf_out;
+    return output_flushed(filter, out_max);
 }
 
 static unsigned char *
@@ -260,15 +795,41 @@ output_string (Filter *filter, const unsigned char *out_end,
     return filter->buf_out_end;
 }
 
+/* When the output is being collected in a string, make sure there's room
+ * for what the algorithm expects to produce from some more input, so that
+ * big inputs don't have to be dealt with by growing the buffer over and
+ * over again.  Small amounts still double the size, as output_string()
+ * does, so that lots of small inputs don't mean lots of reallocation. */
+static void
+reserve_output (Filter *filter, size_t input_size) {
+    size_t used = filter->buf_out_end - filter->buf_out;
+    size_t new_size;
+    unsigned char *out;
+
+    if (filter->do_output != output_string || !filter->size_func)
+        return;
+    new_size = used + filter->size_func(filter, input_size);
+    if (new_size <= filter->buf_out_size)
+        return;
+    if (new_size < filter->buf_out_size * 2)
+        new_size = filter->buf_out_size * 2;
+
+    out = filter->alloc(filter->alloc_ud, filter->buf_out,
+                        filter->buf_out_size, new_size);
+    assert(out);
+    filter->buf_out = out;
+    filter->buf_out_end = out + used;
+    filter->buf_out_size = new_size;
+}
+
 static unsigned char *
 output_c_fh (Filter *filter, const unsigned char *out_end,
              unsigned char **out_max)
 {
-    (void) out_max;     /* unused - it never changes */
     assert(out_end > filter->buf_out);
     assert(out_end >= filter->buf_out_end);
     fwrite(filter->buf_out, 1, out_end - filter->buf_out, filter->c_fh);
-    return filter->buf_out_end = filter->buf_out;
+    return output_flushed(filter, out_max);
 }
 
 static unsigned char *
@@ -276,7 +837,6 @@ output_lua_fh (Filter *filter, const unsigned char *out_end,
                unsigned char **out_max)
 {
     lua_State *L = filter->L;
-    (void) out_max;     /* unused - it never changes */
     assert(out_end > filter->buf_out);
     assert(out_end >= filter->buf_out_end);
 
@@ -303,23 +863,270 @@ output_lua_fh (Filter *filter, const unsigned char *out_end,
         lua_pop(L, 3);          /* pop return vals and file handle */
     }
 
-    return filter->buf_out_end = filter->buf_out;
+    return output_flushed(filter, out_max);
 }
 
 static unsigned char *
 output_luafunc (Filter *filter, const unsigned char *out_end,
                 unsigned char **out_max)
 {
-    (void) out_max;     /* unused - it never changes */
     assert(out_end > filter->buf_out);
     assert(out_end >= filter->buf_out_end);
     lua_rawgeti(filter->L, LUA_REGISTRYINDEX, filter->output_func_ref);
     lua_pushlstring(filter->L, (const char *) filter->buf_out,
                     out_end - filter->buf_out);
     lua_call(filter->L, 1, 0);
+    return output_flushed(filter, out_max);
+}
+
+/* Used for all but the last stage of a pipeline, to feed the output straight
+ * into the next stage's algorithm. */
+static unsigned char *
+output_next_stage (Filter *filter, const unsigned char *out_end,
+                   unsigned char **out_max)
+{
+    assert(out_end > filter->buf_out);
+    assert(out_end >= filter->buf_out_end);
+    if (filter_input(filter->next_stage, filter->buf_out,
+                     out_end - filter->buf_out))
+        lua_error(filter->L);
+    return output_flushed(filter, out_max);
+}
+
+#ifdef DATAFILTER_THREADS
+typedef struct FilterChunk_ {
+    const AlgorithmDefinition *def;
+    Filter *filter;
+    const unsigned char *in;
+    size_t in_len;
+    unsigned char *out;     /* null until the output size is known */
+    size_t out_len;
+} FilterChunk;
+
+/* The pieces done in separate threads have exactly the right amount of
+ * space for their output, so this should never be called. */
+static unsigned char *
+output_chunk_overrun (Filter *filter, const unsigned char *out_end,
+                      unsigned char **out_max)
+{
+    (void) filter;
+    (void) out_end;
+    (void) out_max;
+    assert(0);
+    abort();
+}
+
+/* Runs in a separate thread, first to find out how much output a piece of
+ * the input will produce, and then to produce it.  Nothing in here is
+ * allowed to touch the Lua state. */
+static void *
+filter_chunk_thread (void *arg) {
+    FilterChunk *chunk = arg;
+    Filter *filter = chunk->filter;
+    const unsigned char *left_over;
+
+    if (!chunk->out) {
+        chunk->out_len = chunk->def->chunk_size(filter, chunk->in,
+                                                chunk->in_len);
+        return 0;
+    }
+
+    filter->buf_out = filter->buf_out_end = chunk->out;
+    filter->buf_out_size = chunk->out_len;
+    filter->do_output = output_chunk_overrun;
+    left_over = filter->func(filter, chunk->in, chunk->in + chunk->in_len,
+                             chunk->out, chunk->out + chunk->out_len, 0);
+    assert(left_over == chunk->in + chunk->in_len);
+    assert(filter->buf_out_end == chunk->out + chunk->out_len);
+    (void) left_over;
+    return 0;
+}
+
+/* Run each of the pieces in its own thread, except for the first one which
+ * this thread does while waiting for the others.  If a thread can't be
+ * started then its piece is done here instead. */
+static void
+run_filter_chunks (FilterChunk *chunks, int num_chunks) {
+    pthread_t threads[FILTER_MAX_THREADS];
+    int i, started;
+
+    for (started = 1; started < num_chunks; ++started) {
+        if (pthread_create(&threads[started], 0, filter_chunk_thread,
+                           &chunks[started]))
+            break;
+    }
+    for (i = started; i < num_chunks; ++i)
+        filter_chunk_thread(&chunks[i]);
+    filter_chunk_thread(&chunks[0]);
+    for (i = 1; i < started; ++i)
+        pthread_join(threads[i], 0);
+}
+
+/* Process as much of the input as possible by splitting it into pieces
+ * and doing them in separate threads, each writing its output directly
+ * into the right place in the output buffer.  Any input which is left
+ * over at the end, such as an incomplete group of Base64 input, is left
+ * for the caller to process normally, as the end of the input.  Returns
+ * the number of input bytes done, which will be zero if the input can't
+ * be split up. */
+static size_t
+filter_in_threads (Filter *filter, const AlgorithmDefinition *def,
+                   const unsigned char *s, size_t len, int num_threads)
+{
+    FilterChunk chunks[FILTER_MAX_THREADS];
+    size_t align, chunk_len, done, out_len, new_size, copy_size;
+    unsigned char *copies, *out;
+    int num_chunks, i;
+
+    assert(filter->buf_out_end == filter->buf_out);
+    if (len / FILTER_THREAD_MIN_INPUT < (size_t) num_threads)
+        num_threads = len / FILTER_THREAD_MIN_INPUT;
+    align = def->chunk_align(filter);
+    if (num_threads < 2 || align == 0)
+        return 0;
+
+    /* Always leave something over for the end of the input, which might
+     * need special treatment, like padding on Base64. */
+    chunk_len = (len - 1) / num_threads / align * align;
+    if (chunk_len == 0)
+        return 0;
+    num_chunks = num_threads;
+
+    /* Find out how much output each piece will produce. */
+    for (i = 0; i < num_chunks; ++i) {
+        chunks[i].def = def;
+        chunks[i].filter = filter;
+        chunks[i].in = s + i * chunk_len;
+        chunks[i].in_len = chunk_len;
+        chunks[i].out = 0;
+    }
+    chunks[num_chunks - 1].in_len = (len - 1) / align * align -
+                                    (num_chunks - 1) * chunk_len;
+    run_filter_chunks(chunks, num_chunks);
+
+    done = out_len = 0;
+    for (i = 0; i < num_chunks; ++i) {
+        if (chunks[i].out_len == (size_t) -1)
+            return 0;
+        done += chunks[i].in_len;
+        out_len += chunks[i].out_len;
+    }
+
+    /* Make room for all that, and whatever the rest of the input adds. */
+    new_size = out_len + def->size_func(filter, len - done);
+    if (new_size > filter->buf_out_size) {
+        out = filter->alloc(filter->alloc_ud, filter->buf_out,
+                            filter->buf_out_size, new_size);
+        assert(out);
+        filter->buf_out = filter->buf_out_end = out;
+        filter->buf_out_size = new_size;
+    }
+
+    /* Each thread needs its own copy of the algorithm's state. */
+    copy_size = filter_stage_size(def, 0);
+    copies = filter->alloc(filter->alloc_ud, 0, 0, copy_size * num_chunks);
+    assert(copies);
+    out = filter->buf_out_end;
+    for (i = 0; i < num_chunks; ++i) {
+        chunks[i].filter = (Filter *) (copies + i * copy_size);
+        memcpy(chunks[i].filter, filter, filter->filter_object_size);
+        chunks[i].out = out;
+        out += chunks[i].out_len;
+    }
+    run_filter_chunks(chunks, num_chunks);
+    filter->alloc(filter->alloc_ud, copies, copy_size * num_chunks, 0);
+
+    filter->buf_out_end = out;
+    return done;
+}
+#endif
+
+static int
+get_threads_option (lua_State *L, int options_pos, int *threads) {
+    lua_Number n;
+
+    lua_getfield(L, options_pos, "threads");
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isnumber(L, -1))
+            return luaL_error(L, "bad value for 'threads' option, should be"
+                              " a number");
+        n = lua_tonumber(L, -1);
+        if (!(n >= 1 && n <= FILTER_MAX_THREADS))
+            return luaL_error(L, "bad value for 'threads' option, must be"
+                              " between 1 and %d", FILTER_MAX_THREADS);
+        *threads = (int) n;
+    }
+    lua_pop(L, 1);
+
+    return 1;
+}
+
+/* One-shot calls with small inputs are done without allocating any memory
+ * apart from the result string.  The filter is kept on the C stack, as long
+ * as its algorithm's state isn't too big, and the output is written
+ * straight into a Lua string buffer, which starts off in the same place. */
+#define FILTER_SMALL_INPUT_MAX 1024
+#define FILTER_SMALL_STATE_MAX 512
+
+/* The algorithms can assume they'll have at least this much room after
+ * asking for more. */
+#define FILTER_SMALL_OUTPUT_SIZE (LUAL_BUFFERSIZE < FILTER_MIN_BUFFER_SIZE ? \
+                                  FILTER_MIN_BUFFER_SIZE : LUAL_BUFFERSIZE)
+
+/* Output function for small_algo_wrapper().  The output so far is added to
+ * the string buffer, and the algorithm carries on in some more space. */
+static unsigned char *
+output_small (Filter *filter, const unsigned char *out_end,
+              unsigned char **out_max)
+{
+    luaL_addsize(filter->lbuf, out_end - filter->buf_out);
+    filter->buf_out = (unsigned char *) luaL_prepbuffsize(filter->lbuf,
+                                                          filter->buf_out_size);
+    *out_max = filter->buf_out + filter->buf_out_size;
     return filter->buf_out_end = filter->buf_out;
 }
 
+static int
+small_algo_wrapper (lua_State *L, const AlgorithmDefinition *def,
+                    const unsigned char *s, size_t len, int options_pos)
+{
+    union {
+        Filter filter;
+        long double align_ld;
+        void *align_p;
+        unsigned char bytes[sizeof(Filter) + FILTER_SMALL_STATE_MAX];
+    } storage;
+    Filter *filter = &storage.filter;
+    luaL_Buffer b;
+    int had_error;
+
+    if (!init_filter_state(filter, L, def, options_pos)) {
+        /* The init function might have got part way through. */
+        if (filter->destroy_func)
+            filter->destroy_func(filter);
+        return lua_error(L);
+    }
+
+    filter->buf_in = (unsigned char *) s;
+    filter->buf_in_end = filter->buf_in + len;
+    filter->buf_in_size = len;
+    filter->buf_out_size = FILTER_SMALL_OUTPUT_SIZE;
+    filter->buf_out = filter->buf_out_end = (unsigned char *)
+        luaL_buffinitsize(L, &b, filter->buf_out_size);
+    filter->lbuf = &b;
+    filter->do_output = output_small;
+
+    had_error = do_filtering(filter, 1);
+    if (filter->destroy_func)
+        filter->destroy_func(filter);
+    if (had_error)
+        return lua_error(L);
+
+    luaL_addsize(&b, filter->buf_out_end - filter->buf_out);
+    luaL_pushresult(&b);
+    return 1;
+}
+
 static int
 algo_wrapper (lua_State *L, const AlgorithmDefinition *def) {
     size_t len;
@@ -330,6 +1137,8 @@ algo_wrapper (lua_State *L, const AlgorithmDefinition *def) {
     int num_args = lua_gettop(L);
     int options_pos = 0;
     int had_error;
+    int threads = 1;
+    size_t done = 0;
 
     if (num_args > 2)
         return luaL_error(L, "too many arguments to algorithm function");
@@ -337,8 +1146,13 @@ algo_wrapper (lua_State *L, const AlgorithmDefinition *def) {
         if (!lua_istable(L, 2))
             return luaL_argerror(L, 2, "options must be either nil or a table");
         options_pos = 2;
+        get_threads_option(L, options_pos, &threads);
     }
 
+    if (len <= FILTER_SMALL_INPUT_MAX &&
+        def->state_size <= FILTER_SMALL_STATE_MAX)
+        return small_algo_wrapper(L, def, s, len, options_pos);
+
     alloc = lua_getallocf(L, &alloc_ud);
 
     filter = alloc(alloc_ud, 0, 0, sizeof(Filter) + def->state_size);
@@ -346,26 +1160,43 @@ algo_wrapper (lua_State *L, const AlgorithmDefinition *def) {
     had_error = !init_filter(filter, L, def, options_pos);
 
     if (!had_error) {
-        filter->buf_in = s;
+        /* If we know roughly how much output there will be, allocate that
+         * much to begin with and collect it all in one go.  Otherwise it
+         * gets passed on to a Lua buffer a chunk at a time. */
+        if (def->size_func) {
+            filter->do_output = output_string;
+#ifdef DATAFILTER_THREADS
+            if (threads > 1 && def->chunk_size)
+                done = filter_in_threads(filter, def, s, len, threads);
+#endif
+            reserve_output(filter, len - done);
+        }
+        else {
+            filter->lbuf = filter->alloc(filter->alloc_ud, 0, 0,
+                                         sizeof(luaL_Buffer));
+            assert(filter->lbuf);
+            luaL_buffinit(L, filter->lbuf);
+            filter->do_output = output_lbuf;
+        }
+
+        filter->buf_in = s + done;
         filter->buf_in_end = s + len;
-        filter->buf_in_size = len;
+        filter->buf_in_size = len - done;
         filter->buf_in_free = 0;
-
-        filter->lbuf = filter->alloc(filter->alloc_ud, 0, 0,
-                                     sizeof(luaL_Buffer));
-        assert(filter->lbuf);
-        luaL_buffinit(L, filter->lbuf);
-        filter->do_output = output_lbuf;
-
         had_error = do_filtering(filter, 1);
     }
 
     filter_finished_cleanup(L, filter);
-    if (!had_error)
-        luaL_pushresult(filter->lbuf);
+    if (!had_error) {
+        if (filter->lbuf)
+            luaL_pushresult(filter->lbuf);
+        else
+            lua_pushlstring(L, (const char *) filter->buf_out,
+                            filter->buf_out_end - filter->buf_out);
+    }
 
     destroy_filter(L, filter);
-    filter->alloc(filter->alloc_ud, filter, filter->filter_object_size, 0);
+    alloc(alloc_ud, filter, filter->filter_object_size, 0);
 
     if (had_error)
         return lua_error(L);
@@ -377,10 +1208,152 @@ algo_wrapper (lua_State *L, const AlgorithmDefinition *def) {
 #include "algo/pctenc.c"
 #include "algo/md5.c"
 #include "algo/sha1.c"
+#include "algo/sha256.c"
 #include "algo/adler32.c"
+#include "algo/crc32.c"
+#include "algo/blake3.c"
 #include "algo/hex.c"
 #include "algorithms.c"
 
+/* The message currently being hashed in one lane of a MultiBufHash. */
+typedef struct MultiBufLane_ {
+    const unsigned char *data;
+    size_t index;           /* position in the table of input strings */
+    size_t block, full_blocks, num_blocks;
+    unsigned char tail[128];
+} MultiBufLane;
+
+/* Set up a lane to hash a new message, with its end padded to one or two
+ * blocks in 'tail'. */
+static void
+multibuf_start_lane (const MultiBufHash *hash, uint32_t *state,
+                     MultiBufLane *lane, int lane_num,
+                     const unsigned char *data, size_t len)
+{
+    uint64_t num_bits = (uint64_t) len * 8;
+    unsigned char *len_out;
+    int i, numbytes = len % 64;
+
+    for (i = 0; i < hash->digest_words; ++i)
+        state[i * MULTIBUF_MAX_LANES + lane_num] = hash->initial_state[i];
+
+    lane->data = data;
+    lane->block = 0;
+    lane->full_blocks = len / 64;
+    lane->num_blocks = lane->full_blocks + (numbytes > 64 - 9 ? 2 : 1);
+    memcpy(lane->tail, data + lane->full_blocks * 64, numbytes);
+    memset(lane->tail + numbytes, 0, 128 - numbytes);
+    lane->tail[numbytes] = 0x80;
+
+    len_out = lane->tail + (lane->num_blocks - lane->full_blocks) * 64 - 8;
+    for (i = 0; i < 8; ++i, num_bits >>= 8)
+        len_out[hash->big_endian ? 7 - i : i] = num_bits & 0xFF;
+}
+
+static void
+multibuf_lane_digest (const MultiBufHash *hash, const uint32_t *state,
+                      int lane_num, unsigned char *out)
+{
+    int i;
+    for (i = 0; i < hash->digest_words; ++i, out += 4) {
+        uint32_t v = state[i * MULTIBUF_MAX_LANES + lane_num];
+        if (hash->big_endian) {
+            out[0] = v >> 24;  out[1] = (v >> 16) & 0xFF;
+            out[2] = (v >> 8) & 0xFF;  out[3] = v & 0xFF;
+        }
+        else {
+            out[0] = v & 0xFF;  out[1] = (v >> 8) & 0xFF;
+            out[2] = (v >> 16) & 0xFF;  out[3] = v >> 24;
+        }
+    }
+}
+
+/* Takes a table of strings and returns a table of their digests, in the
+ * same order.  Each lane hashes one message at a time, and as soon as it
+ * finishes one it is given the next, so that lanes aren't left idle when
+ * the messages are of different lengths.  Lanes with no more messages to
+ * do, and the other lanes of a SIMD function which has fewer than the
+ * maximum, are given a block of zeros to chew on, and flagged as inactive
+ * so that their state doesn't change. */
+static int
+multibuf_hash_many (lua_State *L, const MultiBufHash *hash) {
+    static const unsigned char zero_block[64] = { 0 };
+    uint32_t state[5 * MULTIBUF_MAX_LANES];
+    MultiBufLane lanes[MULTIBUF_MAX_LANES];
+    const unsigned char *blocks[MULTIBUF_MAX_LANES];
+    unsigned char digest[20];
+    size_t num_msgs, next_msg = 0, len;
+    const char *data;
+    unsigned int active = 0;
+    int i;
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+    num_msgs = lua_rawlen(L, 1);
+    lua_createtable(L, num_msgs, 0);
+
+    for (i = 0; i < MULTIBUF_MAX_LANES; ++i)
+        blocks[i] = zero_block;
+
+    while (1) {
+        /* Give any idle lanes a new message.  The strings stay referenced
+         * by the table, so pointers to their contents remain valid. */
+        for (i = 0; i < hash->num_lanes && next_msg < num_msgs; ++i) {
+            if (active & (1u << i))
+                continue;
+            lua_rawgeti(L, 1, ++next_msg);
+            if (lua_type(L, -1) != LUA_TSTRING)
+                return luaL_argerror(L, 1, "table should contain only"
+                                     " strings");
+            data = lua_tolstring(L, -1, &len);
+            lua_pop(L, 1);
+            multibuf_start_lane(hash, state, &lanes[i], i,
+                                (const unsigned char *) data, len);
+            lanes[i].index = next_msg;
+            active |= 1u << i;
+        }
+        if (!active)
+            break;
+
+        for (i = 0; i < hash->num_lanes; ++i) {
+            MultiBufLane *lane = &lanes[i];
+            if (!(active & (1u << i)))
+                blocks[i] = zero_block;
+            else if (lane->block < lane->full_blocks)
+                blocks[i] = lane->data + lane->block * 64;
+            else
+                blocks[i] = lane->tail +
+                            (lane->block - lane->full_blocks) * 64;
+        }
+        hash->func(state, blocks, active);
+
+        for (i = 0; i < hash->num_lanes; ++i) {
+            if (!(active & (1u << i)) ||
+                ++lanes[i].block < lanes[i].num_blocks)
+                continue;
+            multibuf_lane_digest(hash, state, i, digest);
+            lua_pushlstring(L, (const char *) digest, hash->digest_words * 4);
+            lua_rawseti(L, -2, lanes[i].index);
+            active &= ~(1u << i);
+        }
+    }
+
+    return 1;
+}
+
+static int
+filter_md5_many (lua_State *L) {
+    MultiBufHash hash;
+    md5_multibuf_setup(&hash);
+    return multibuf_hash_many(L, &hash);
+}
+
+static int
+filter_sha1_many (lua_State *L) {
+    MultiBufHash hash;
+    sha1_multibuf_setup(&hash);
+    return multibuf_hash_many(L, &hash);
+}
+
 static int
 contains_null_byte (const char *s, size_t len) {
     size_t i;
@@ -393,57 +1366,419 @@ contains_null_byte (const char *s, size_t len) {
     return 0;
 }
 
+#ifdef DATAFILTER_ASYNC
+/* In async mode, input given to add() is copied into a ring buffer, and a
+ * background thread takes it out and feeds it to the algorithm.  There's
+ * only one thread putting data in and one taking it out, so the ring needs
+ * no locking, just atomic access to the counts of bytes put in ('head')
+ * and taken out ('tail').  The mutex and condition variable are only used
+ * by either side to wait for the other when the ring is full or empty.
+ * While the thread is running the filter has no Lua state, so errors from
+ * the algorithm are left in filter->error, and 'failed' is set. */
+
+typedef struct AsyncInput_ {
+    unsigned char *ring;
+    size_t size;
+    size_t head, tail;
+    int closing, failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AsyncInput;
+
+#define ASYNC_LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define ASYNC_STORE(var, value) __atomic_store_n(&(var), value, \
+                                                 __ATOMIC_RELEASE)
+
+static void
+async_wake (AsyncInput *async) {
+    pthread_mutex_lock(&async->lock);
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->lock);
+}
+
+static void *
+async_thread (void *arg) {
+    Filter *filter = arg;
+    AsyncInput *async = filter->async;
+    size_t head, tail = async->tail, pos, len;
+
+    while (1) {
+        head = ASYNC_LOAD(async->head);
+        if (head == tail) {
+            pthread_mutex_lock(&async->lock);
+            while (ASYNC_LOAD(async->head) == tail &&
+                   !ASYNC_LOAD(async->closing))
+                pthread_cond_wait(&async->cond, &async->lock);
+            pthread_mutex_unlock(&async->lock);
+            if (ASYNC_LOAD(async->head) == tail)
+                break;      /* closing, and nothing left to do */
+            continue;
+        }
+
+        /* Anything after an error is thrown away. */
+        pos = tail % async->size;
+        len = head - tail;
+        if (len > async->size - pos)
+            len = async->size - pos;
+        if (!async->failed && filter_input(filter, async->ring + pos, len))
+            ASYNC_STORE(async->failed, 1);
+        tail += len;
+        ASYNC_STORE(async->tail, tail);
+        async_wake(async);
+    }
+
+    return 0;
+}
+
+/* Throw any error reported by the algorithm in the background thread. */
+static void
+async_check_error (lua_State *L, Filter *filter) {
+    if (ASYNC_LOAD(filter->async->failed))
+        luaL_error(L, "%s", filter->error);
+}
+
+static void
+async_add (Filter *filter, const unsigned char *s, size_t len) {
+    AsyncInput *async = filter->async;
+    size_t head = async->head, pos, space;
+
+    while (len > 0) {
+        space = async->size - (head - ASYNC_LOAD(async->tail));
+        if (space == 0) {
+            pthread_mutex_lock(&async->lock);
+            while (ASYNC_LOAD(async->tail) + async->size == head)
+                pthread_cond_wait(&async->cond, &async->lock);
+            pthread_mutex_unlock(&async->lock);
+            continue;
+        }
+
+        pos = head % async->size;
+        if (space > async->size - pos)
+            space = async->size - pos;
+        if (space > len)
+            space = len;
+        memcpy(async->ring + pos, s, space);
+        s += space;
+        len -= space;
+        head += space;
+        ASYNC_STORE(async->head, head);
+        async_wake(async);
+    }
+}
+
+/* Stop the background thread, once it has finished with all its input,
+ * and go back to normal mode.  Returns true if the algorithm reported an
+ * error, with the message in filter->error. */
 static int
-filter_new (lua_State *L) {
-    size_t algo_name_len, filename_len;
-    const char *algo_name = luaL_checklstring(L, 2, &algo_name_len);
-    const char *filename;
+async_stop (lua_State *L, Filter *filter) {
+    AsyncInput *async = filter->async;
+    int failed;
+
+    ASYNC_STORE(async->closing, 1);
+    async_wake(async);
+    pthread_join(async->thread, 0);
+    failed = async->failed;
+
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->lock);
+    free(async->ring);
+    free(async);
+    filter->async = 0;
+    filter->L = L;
+    return failed;
+}
+
+/* Start a background thread with a ring buffer of 'size' bytes.  If that
+ * isn't possible the filter just carries on in normal mode. */
+static void
+async_start (lua_State *L, Filter *filter, size_t size) {
+    AsyncInput *async = malloc(sizeof(AsyncInput));
+
+    if (!async)
+        return;
+    async->ring = malloc(size);
+    if (!async->ring) {
+        free(async);
+        return;
+    }
+    async->size = size;
+    async->head = async->tail = 0;
+    async->closing = async->failed = 0;
+    pthread_mutex_init(&async->lock, 0);
+    pthread_cond_init(&async->cond, 0);
+
+    filter->async = async;
+    filter->L = 0;
+    if (pthread_create(&async->thread, 0, async_thread, filter)) {
+        pthread_cond_destroy(&async->cond);
+        pthread_mutex_destroy(&async->lock);
+        free(async->ring);
+        free(async);
+        filter->async = 0;
+        filter->L = L;
+    }
+}
+#endif
+
+/* Find the definition of the algorithm named by the value at 'idx' on the
+ * stack, raising an error about argument 'arg' if there isn't one. */
+static const AlgorithmDefinition *
+find_algorithm (lua_State *L, int idx, int arg) {
+    size_t algo_name_len;
+    const char *algo_name;
     unsigned int i;
     const AlgorithmDefinition *def;
-    Filter *filter;
-    int num_args = lua_gettop(L);
-    int arg_type;
-    int options_pos = 0;
 
-    luaL_argcheck(L, !contains_null_byte(algo_name, algo_name_len), 2,
+    if (!lua_isstring(L, idx))
+        luaL_argerror(L, arg, "algorithm name must be a string");
+    algo_name = lua_tolstring(L, idx, &algo_name_len);
+    luaL_argcheck(L, !contains_null_byte(algo_name, algo_name_len), arg,
                   "invalid algorithm name");
 
-    if (num_args > 4)
-        return luaL_error(L, "too many arguments to datafilter:new()");
-
-    /* Find the definition of the named algorithm. */
     def = filter_algorithms;
     for (i = 0; i < NUM_ALGO_DEFS; ++i, ++def) {
         if (!strcmp(def->name, algo_name))
-            break;
+            return def;
     }
-    if (i == NUM_ALGO_DEFS)
-        return luaL_argerror(L, 2, "unrecognized algorithm name");
 
-    /* Check the options table. */
-    if (num_args >= 4 && !lua_isnil(L, 4)) {
-        if (!lua_istable(L, 4))
-            return luaL_argerror(L, 4, "options must be either nil or a table");
-        options_pos = 4;
+    luaL_argerror(L, arg, "unrecognized algorithm name");
+    return 0;
+}
+
+/* The definition of the algorithm used by a filter, or null for a tee. */
+static const AlgorithmDefinition *
+filter_definition (const Filter *filter) {
+    const AlgorithmDefinition *def;
+
+    for (def = filter_algorithms; def < filter_algorithms + NUM_ALGO_DEFS;
+         ++def)
+    {
+        if (def->func == filter->func)
+            return def;
     }
 
-    /* Create the filter object.  If there's an error initializing it, make
-     * sure the userdata is cleaned up properly. */
-    filter = lua_newuserdata(L, sizeof(Filter) + def->state_size);
+    return 0;
+}
+
+/* Run an algorithm over each string in an array, returning an array of the
+ * results.  The options are only dealt with once, and the same filter and
+ * output buffer are used for all the strings, with the algorithm's state
+ * put back to how it was after initialization before each one.  Without
+ * options, MD5 and SHA-1 are left to md5_many() and sha1_many(), which can
+ * hash several strings at once. */
+static int
+filter_batch (lua_State *L) {
+    const AlgorithmDefinition *def;
+    Filter *filter;
+    int num_args = lua_gettop(L);
+    int options_pos = 0, num_items, i;
+    size_t len;
+    const char *s;
+
+    if (num_args > 3)
+        return luaL_error(L, "too many arguments to datafilter.batch()");
+    def = find_algorithm(L, 1, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    if (num_args >= 3 && !lua_isnil(L, 3)) {
+        if (!lua_istable(L, 3))
+            return luaL_argerror(L, 3, "options must be either nil or a table");
+        options_pos = 3;
+    }
+
+    num_items = (int) lua_rawlen(L, 2);
+    for (i = 1; i <= num_items; ++i) {
+        lua_rawgeti(L, 2, i);
+        if (lua_type(L, -1) != LUA_TSTRING)
+            return luaL_argerror(L, 2, "table should contain only strings");
+        lua_pop(L, 1);
+    }
+
+    if (!options_pos && def->func == algo_md5) {
+        lua_settop(L, 2);
+        lua_remove(L, 1);
+        return filter_md5_many(L);
+    }
+    if (!options_pos && def->func == algo_sha1) {
+        lua_settop(L, 2);
+        lua_remove(L, 1);
+        return filter_sha1_many(L);
+    }
+
+    filter = lua_newuserdata(L, sizeof(Filter) + 2 * def->state_size);
     if (!init_filter(filter, L, def, options_pos)) {
         destroy_filter(L, filter);
         return lua_error(L);
     }
+    memcpy(ALGO_INITIAL_STATE(filter), ALGO_STATE(filter), def->state_size);
+    filter->do_output = output_string;
+    filter->buf_in_free = 0;
+
+    lua_createtable(L, num_items, 0);
+    for (i = 1; i <= num_items; ++i) {
+        lua_rawgeti(L, 2, i);
+        s = lua_tolstring(L, -1, &len);
+
+        if (i > 1)
+            memcpy(ALGO_STATE(filter), ALGO_INITIAL_STATE(filter),
+                   def->state_size);
+        filter->buf_in = (unsigned char *) s;
+        filter->buf_in_end = filter->buf_in + len;
+        filter->buf_in_size = len;
+        filter->buf_out_end = filter->buf_out;
+        reserve_output(filter, len);
+        if (do_filtering(filter, 1)) {
+            lua_pushfstring(L, "error processing string %d: %s", i,
+                            lua_tostring(L, -1));
+            destroy_filter(L, filter);
+            return lua_error(L);
+        }
+
+        lua_pushlstring(L, (const char *) filter->buf_out,
+                        filter->buf_out_end - filter->buf_out);
+        lua_rawseti(L, -3, i);
+        lua_pop(L, 1);
+    }
+
+    filter->buf_in = 0;
+    destroy_filter(L, filter);
+    return 1;
+}
+
+/* Push the algorithm name and options table (or nil) for one stage of a new
+ * filter, and return the algorithm's definition.  The second argument to
+ * new() is either a single algorithm name, or a list of stages, each of
+ * which is either a name or a table containing a name and options to use
+ * for that stage instead of the ones given as the fourth argument. */
+static const AlgorithmDefinition *
+push_filter_stage (lua_State *L, int stage, int options_pos) {
+    if (lua_istable(L, 2)) {
+        lua_rawgeti(L, 2, stage);
+        if (lua_istable(L, -1)) {
+            lua_rawgeti(L, -1, 1);
+            lua_rawgeti(L, -2, 2);
+            lua_remove(L, -3);
+            if (!lua_isnil(L, -1)) {
+                if (!lua_istable(L, -1))
+                    luaL_argerror(L, 2, "stage options must be either nil or"
+                                  " a table");
+                return find_algorithm(L, -2, 2);
+            }
+            lua_pop(L, 1);
+        }
+    }
+    else
+        lua_pushvalue(L, 2);
+
+    if (options_pos)
+        lua_pushvalue(L, options_pos);
+    else
+        lua_pushnil(L);
+    return find_algorithm(L, -2, 2);
+}
+
+/* Create a userdata containing a filter for each of the stages listed in
+ * the second argument, linked together.  With 'tee' true, they are preceded
+ * by an extra filter which passes its input on to all of them, and they
+ * all collect their output as strings.  Otherwise they form a pipeline,
+ * and the caller must decide where the output of the last one goes. */
+static Filter *
+create_filter_stages (lua_State *L, int options_pos, int tee) {
+    int num_stages, i;
+    size_t size;
+    const AlgorithmDefinition *def;
+    Filter *filter, *stage, *prev;
+
+    if (lua_istable(L, 2)) {
+        num_stages = (int) lua_rawlen(L, 2);
+        luaL_argcheck(L, num_stages > 0, 2, "list of stages is empty");
+    }
+    else {
+        luaL_checkstring(L, 2);
+        num_stages = 1;
+    }
+
+    /* Find the definitions of the algorithms, to see how much memory all
+     * the stages will need. */
+    size = tee ? filter_stage_size(&tee_algorithm, 1) : 0;
+    for (i = 1; i <= num_stages; ++i) {
+        def = push_filter_stage(L, i, options_pos);
+        size += filter_stage_size(def, 1);
+        lua_pop(L, 2);
+    }
+
+    /* Create the filter object.  If there's an error initializing it, make
+     * sure the userdata is cleaned up properly. */
+    filter = lua_newuserdata(L, size);
+    stage = filter;
+    prev = 0;
+    if (tee) {
+        if (!init_filter(filter, L, &tee_algorithm, options_pos)) {
+            destroy_filter(L, filter);
+            lua_error(L);
+        }
+        filter->is_tee = 1;
+        prev = stage;
+        stage = (Filter *) (((char *) stage) +
+                            filter_stage_size(&tee_algorithm, 1));
+    }
+    for (i = 1; i <= num_stages; ++i) {
+        def = push_filter_stage(L, i, options_pos);
+        if (prev)
+            prev->next_stage = stage;
+        if (!init_filter(stage, L, def,
+                         lua_isnil(L, -1) ? 0 : lua_gettop(L)))
+        {
+            destroy_filter(L, filter);
+            lua_error(L);
+        }
+        memcpy(ALGO_INITIAL_STATE(stage), ALGO_STATE(stage), def->state_size);
+        lua_pop(L, 2);
+        prev = stage;
+        stage = (Filter *) (((char *) stage) + filter_stage_size(def, 1));
+    }
 
     luaL_getmetatable(L, FILTER_MT_NAME);
     lua_setmetatable(L, -2);
 
-    filter->buf_in = filter->buf_in_end
-                   = filter->alloc(filter->alloc_ud, 0, 0, BUFSIZ);
-    assert(filter->buf_in);
-    filter->buf_in_size = BUFSIZ;
-    filter->buf_in_free = 1;
-    filter->do_output = 0;
+    for (stage = filter; stage; stage = stage->next_stage) {
+        stage->buf_in = stage->buf_in_end = stage->alloc(stage->alloc_ud, 0, 0,
+                                                         stage->buf_in_size);
+        assert(stage->buf_in);
+        stage->buf_in_free = 1;
+        if (tee)
+            stage->do_output = output_string;
+        else
+            stage->do_output = stage->next_stage ? output_next_stage : 0;
+        if (stage->async_option && (tee || filter->next_stage))
+            luaL_argerror(L, 2, "async mode only works with a single"
+                          " algorithm");
+    }
+
+    return filter;
+}
+
+static int
+filter_new (lua_State *L) {
+    size_t async_size;
+    size_t filename_len;
+    const char *filename;
+    Filter *last;
+    int num_args = lua_gettop(L);
+    int arg_type;
+    int options_pos = 0;
+
+    if (num_args > 4)
+        return luaL_error(L, "too many arguments to datafilter:new()");
+
+    /* Check the options table. */
+    if (num_args >= 4 && !lua_isnil(L, 4)) {
+        if (!lua_istable(L, 4))
+            return luaL_argerror(L, 4, "options must be either nil or a table");
+        options_pos = 4;
+    }
+
+    last = last_stage(create_filter_stages(L, options_pos, 0));
 
     /* Figure out where to send the output to. */
     if (num_args >= 3 && !lua_isnil(L, 3)) {
@@ -452,16 +1787,16 @@ filter_new (lua_State *L) {
             filename = lua_tolstring(L, 3, &filename_len);
             luaL_argcheck(L, !contains_null_byte(filename, filename_len), 3,
                           "invalid file name");
-            filter->c_fh = fopen(filename, "wb");
-            if (!filter->c_fh)
+            last->c_fh = fopen(filename, "wb");
+            if (!last->c_fh)
                 return luaL_error(L, "error opening file '%s': %s", filename,
                                   strerror(errno));
-            filter->do_output = output_c_fh;
+            last->do_output = output_c_fh;
         }
         else if (arg_type == LUA_TFUNCTION) {
             lua_pushvalue(L, 3);
-            filter->output_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-            filter->do_output = output_luafunc;
+            last->output_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            last->do_output = output_luafunc;
         }
         else if (arg_type == LUA_TTABLE || arg_type == LUA_TUSERDATA) {
             lua_getfield(L, 3, "write");
@@ -474,14 +1809,57 @@ filter_new (lua_State *L) {
             lua_pop(L, 1);
 
             lua_pushvalue(L, 3);
-            filter->l_fh_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-            filter->do_output = output_lua_fh;
+            last->l_fh_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            last->do_output = output_lua_fh;
         }
         else
             return luaL_argerror(L, 2, "invalid type for output destination");
     }
     else
-        filter->do_output = output_string;
+        last->do_output = output_string;
+
+    if (last->async_option) {
+        if (last->do_output != output_string && last->do_output != output_c_fh)
+            return luaL_argerror(L, 3, "async mode only works with output to"
+                                 " a string or a named file");
+        async_size = FILTER_ASYNC_DEFAULT_SIZE;
+        if (options_pos &&
+            !get_buffer_size_option(L, options_pos, "async_buffer_size",
+                                    &async_size))
+            return lua_error(L);
+#ifdef DATAFILTER_ASYNC
+        last->async_size = async_size;
+        async_start(L, last, async_size);
+#endif
+    }
+
+    return 1;
+}
+
+static int
+filter_new_tee (lua_State *L) {
+    int num_args = lua_gettop(L);
+    int options_pos = 0;
+    Filter *filter, *branch, *other;
+
+    if (num_args > 3)
+        return luaL_error(L, "too many arguments to datafilter:new_tee()");
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    if (num_args >= 3 && !lua_isnil(L, 3)) {
+        if (!lua_istable(L, 3))
+            return luaL_argerror(L, 3, "options must be either nil or a table");
+        options_pos = 3;
+    }
+
+    filter = create_filter_stages(L, options_pos, 1);
+
+    /* The results are keyed by algorithm name, so they must be distinct. */
+    for (branch = filter->next_stage; branch; branch = branch->next_stage) {
+        for (other = branch->next_stage; other; other = other->next_stage)
+            if (!strcmp(branch->algo_name, other->algo_name))
+                return luaL_argerror(L, 2, "algorithm listed more than once");
+    }
 
     return 1;
 }
@@ -489,39 +1867,114 @@ filter_new (lua_State *L) {
 static int
 filter_add (lua_State *L) {
     Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
-    size_t len, load_bytes, max_bytes;
+    size_t len;
     const unsigned char *s = (unsigned char *) luaL_checklstring(L, 2, &len);
-    const unsigned char *s_end = s + len;
 
     if (filter->finished)
         return luaL_error(L, "output has been finalized, it's too late to"
                           " add more input");
 
-    while (s < s_end) {
-        /* Top up the input buffer with as much as we can fit in. */
-        max_bytes = filter->buf_in_size - (filter->buf_in_end - filter->buf_in);
-        load_bytes = s_end - s;
-        if (load_bytes > max_bytes)
-            load_bytes = max_bytes;
-        assert(load_bytes > 0);
-
-        add_input_data(filter, (const unsigned char *) s, load_bytes);
-        s += load_bytes;
-        if (do_filtering(filter, 0))
-            return lua_error(L);
+#ifdef DATAFILTER_ASYNC
+    if (filter->async) {
+        async_check_error(L, filter);
+        async_add(filter, s, len);
+        return 0;
     }
+#endif
+
+    reserve_output(filter, len);
+    if (filter_input(filter, s, len))
+        return lua_error(L);
 
     return 0;
 }
 
-static void
-filter_addfile_filename (lua_State *L, Filter *filter, const char *filename) {
+/* The ways filter_read_file() can fail, apart from the algorithm reporting
+ * an error.  The cause is left in errno, and these are the messages to give
+ * for them, with the filename and the cause filled in. */
+#define READ_FILE_OK 0
+#define READ_FILE_ALGO_ERROR 1
+#define READ_FILE_OPEN_ERROR 2
+#define READ_FILE_READ_ERROR 3
+#define READ_FILE_MAP_ERROR 4
+
+static const char *const
+read_file_error_format[] = {
+    0, 0,
+    "error opening file '%s': %s",
+    "error reading from file '%s': %s",
+    "error mapping file '%s' into memory: %s"
+};
+
+#ifdef DATAFILTER_MMAP
+/* Feed a regular file to the algorithm by mapping it into memory, a big
+ * window at a time, so that it can be processed without being copied.
+ * Returns -1 without doing anything if that isn't possible, for example
+ * because it's a pipe or device, or the mapping fails, in which case the
+ * file should be read normally from the same descriptor.  This doesn't
+ * close the file. */
+static int
+filter_read_file_mmap (Filter *filter, int fd) {
+    struct stat st;
+    off_t offset;
+    size_t len;
+    void *map;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return -1;
+
+    reserve_output(filter, st.st_size);
+    for (offset = 0; offset < st.st_size; offset += len) {
+        len = st.st_size - offset > MMAP_WINDOW_SIZE ? MMAP_WINDOW_SIZE
+                                                     : st.st_size - offset;
+        map = mmap(0, len, PROT_READ, MAP_SHARED, fd, offset);
+        if (map == MAP_FAILED)
+            return offset == 0 ? -1 : READ_FILE_MAP_ERROR;
+        posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+
+        /* Anything the algorithm doesn't use up gets copied into the input
+         * buffer, so it's safe to unmap this straight away. */
+        if (filter_input(filter, map, len)) {
+            munmap(map, len);
+            return READ_FILE_ALGO_ERROR;
+        }
+        munmap(map, len);
+    }
+
+    return READ_FILE_OK;
+}
+#endif
+
+/* Feed the contents of a named file to the algorithm, without finishing
+ * it off.  This doesn't use the Lua state, except for the algorithm's
+ * error message if it has one.  The file is only opened once, since
+ * opening something like a named pipe twice would lose its data. */
+static int
+filter_read_file (Filter *filter, const char *filename) {
     size_t max_bytes, bytes_read;
     FILE *f;
-
+    int err;
+#ifdef DATAFILTER_MMAP
+    int fd, status;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return READ_FILE_OPEN_ERROR;
+    status = filter_read_file_mmap(filter, fd);
+    f = status < 0 ? fdopen(fd, "rb") : 0;
+    if (!f) {
+        if (status < 0)
+            status = READ_FILE_OPEN_ERROR;
+        err = errno;
+        close(fd);
+        errno = err;
+        return status;
+    }
+#else
     f = fopen(filename, "rb");
     if (!f)
-        luaL_error(L, "error opening file '%s': %s", filename, strerror(errno));
+        return READ_FILE_OPEN_ERROR;
+#endif
 
     while (!feof(f)) {
         /* Top up the input buffer with as much as we can fit in. */
@@ -529,34 +1982,49 @@ filter_addfile_filename (lua_State *L, Filter *filter, const char *filename) {
         errno = 0;
         bytes_read = fread(filter->buf_in_end, 1, max_bytes, f);
         if (errno) {
+            err = errno;
             fclose(f);
-            luaL_error(L, "error reading from file '%s': %s", filename,
-                       strerror(errno));
+            errno = err;
+            return READ_FILE_READ_ERROR;
         }
 
         filter->buf_in_end += bytes_read;
+        if (bytes_read == max_bytes)
+            input_filled(filter);
         if (do_filtering(filter, 0)) {
             fclose(f);
-            lua_error(L);
+            return READ_FILE_ALGO_ERROR;
         }
     }
 
     fclose(f);
+    return READ_FILE_OK;
+}
+
+static void
+filter_addfile_filename (lua_State *L, Filter *filter, const char *filename) {
+    int status = filter_read_file(filter, filename);
+
+    if (status == READ_FILE_ALGO_ERROR)
+        lua_error(L);
+    else if (status != READ_FILE_OK)
+        luaL_error(L, read_file_error_format[status], filename,
+                   strerror(errno));
 }
 
 static void
 filter_addfile_function (lua_State *L, Filter *filter,
                          int handlepos, int funcpos)
 {
-    size_t bytes_read;
+    size_t max_bytes, bytes_read;
     const char *data;
 
     while (1) {
         /* Top up the input buffer with as much as we can fit in. */
+        max_bytes = filter->buf_in_size - (filter->buf_in_end - filter->buf_in);
         lua_pushvalue(L, funcpos);
         lua_pushvalue(L, handlepos);
-        lua_pushinteger(L, filter->buf_in_size -
-                                (filter->buf_in_end - filter->buf_in));
+        lua_pushinteger(L, max_bytes);
         lua_call(L, 2, 2);
 
         if (lua_isnil(L, -2)) {
@@ -577,17 +2045,39 @@ filter_addfile_function (lua_State *L, Filter *filter,
         }
 
         data = lua_tolstring(L, -2, &bytes_read);
-        add_input_data(filter, (const unsigned char *) data, bytes_read);
-        if (do_filtering(filter, 0))
+        if (filter_input(filter, (const unsigned char *) data, bytes_read))
             lua_error(L);
+        if (bytes_read == max_bytes)
+            input_filled(filter);
 
         lua_pop(L, 2);
     }
 }
 
+/* Read the file given to :addfile(), which has already been checked.  The
+ * filter is at index 1 and the filename or file handle at index 2, with
+ * the handle's 'read' method at index 3 if it's a handle.  This is called
+ * in protected mode in async mode, so that the background thread can be
+ * restarted even if reading fails. */
+static int
+filter_addfile_read (lua_State *L) {
+    Filter *filter = lua_touserdata(L, 1);
+
+    if (lua_isfunction(L, 3))
+        filter_addfile_function(L, filter, 2, 3);
+    else
+        filter_addfile_filename(L, filter, lua_tostring(L, 2));
+
+    return 0;
+}
+
 static int
 filter_addfile (lua_State *L) {
     Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+#ifdef DATAFILTER_ASYNC
+    size_t async_size;
+    int status;
+#endif
     size_t filename_len;
     const char *filename;
     int num_args = lua_gettop(L);
@@ -605,7 +2095,6 @@ filter_addfile (lua_State *L) {
         filename = luaL_checklstring(L, 2, &filename_len);
         luaL_argcheck(L, !contains_null_byte(filename, filename_len), 2,
                       "invalid file name");
-        filter_addfile_filename(L, filter, filename);
     }
     else if (arg_type == LUA_TTABLE || arg_type == LUA_TUSERDATA) {
         lua_getfield(L, 2, "read");
@@ -615,33 +2104,315 @@ filter_addfile (lua_State *L) {
         else if (!lua_isfunction(L, -1))
             return luaL_argerror(L, 2, "not a file handle object, 'read'"
                                  " method is not a function");
-        filter_addfile_function(L, filter, 2, 3);
     }
     else
         return luaL_argerror(L, 2, "bad type of file input, should be a"
                              " filename or file handle object");
 
+#ifdef DATAFILTER_ASYNC
+    /* Files are read in this thread, with the background one stopped until
+     * it's done, so that errors can be reported in the normal way.  The
+     * background thread is started again whether the read worked or not. */
+    if (filter->async) {
+        async_size = filter->async->size;
+        if (async_stop(L, filter))
+            return luaL_error(L, "%s", filter->error);
+        lua_pushcfunction(L, filter_addfile_read);
+        lua_insert(L, 1);
+        status = lua_pcall(L, lua_gettop(L) - 1, 0, 0);
+        async_start(L, filter, async_size);
+        return status ? lua_error(L) : 0;
+    }
+#endif
+
+    return filter_addfile_read(L);
+}
+
+typedef struct FileResult_ {
+    int status;             /* one of the READ_FILE_* values */
+    int err;                /* errno, for the error message */
+    const char *algo_error;
+    unsigned char *out;     /* allocated with system_alloc() */
+    size_t out_len, out_size;
+} FileResult;
+
+/* Run the algorithm over one file, using a copy of 'model', which has been
+ * initialized with the options but never used.  The copy shares anything
+ * the model's state points to, so it mustn't be destroyed in the usual way.
+ * This never touches the Lua state. */
+static void
+filter_one_file (const Filter *model, const char *filename,
+                 FileResult *result)
+{
+    Filter *filter = malloc(model->filter_object_size);
+    assert(filter);
+    memcpy(filter, model, model->filter_object_size);
+
+    filter->L = 0;
+    filter->alloc = system_alloc;
+    filter->alloc_ud = 0;
+    filter->destroy_func = 0;
+    filter->buf_in = filter->buf_in_end = malloc(filter->buf_in_size);
+    filter->buf_out = filter->buf_out_end = malloc(filter->buf_out_size);
+    assert(filter->buf_in && filter->buf_out);
+    filter->buf_in_free = 1;
+    filter->do_output = output_string;
+
+    result->status = filter_read_file(filter, filename);
+    result->err = errno;
+    if (result->status == READ_FILE_OK && do_filtering(filter, 1))
+        result->status = READ_FILE_ALGO_ERROR;
+    result->algo_error = filter->error;
+    result->out = filter->buf_out;
+    result->out_len = filter->buf_out_end - filter->buf_out;
+    result->out_size = filter->buf_out_size;
+
+    free(filter->buf_in);
+    free(filter);
+}
+
+typedef struct FileJob_ {
+    const Filter *model;
+    const char **filenames;
+    FileResult *results;
+    int num_files, next_file;
+#ifdef DATAFILTER_THREADS
+    pthread_mutex_t lock;
+#endif
+} FileJob;
+
+/* Each thread, including the calling one, keeps taking the next file which
+ * nobody has started on yet, until there are none left. */
+static void *
+file_job_thread (void *arg) {
+    FileJob *job = arg;
+    int i;
+
+    while (1) {
+#ifdef DATAFILTER_THREADS
+        pthread_mutex_lock(&job->lock);
+#endif
+        i = job->next_file++;
+#ifdef DATAFILTER_THREADS
+        pthread_mutex_unlock(&job->lock);
+#endif
+        if (i >= job->num_files)
+            break;
+        filter_one_file(job->model, job->filenames[i], &job->results[i]);
+    }
+
     return 0;
 }
 
+static void
+run_file_job (FileJob *job, int num_threads) {
+#ifdef DATAFILTER_THREADS
+    pthread_t threads[FILTER_MAX_THREADS];
+    int i, started;
+
+    if (num_threads > job->num_files)
+        num_threads = job->num_files;
+    pthread_mutex_init(&job->lock, 0);
+    for (started = 1; started < num_threads; ++started) {
+        if (pthread_create(&threads[started], 0, file_job_thread, job))
+            break;
+    }
+    file_job_thread(job);
+    for (i = 1; i < started; ++i)
+        pthread_join(threads[i], 0);
+    pthread_mutex_destroy(&job->lock);
+#else
+    (void) num_threads;
+    file_job_thread(job);
+#endif
+}
+
+/* By default hash_files() uses one thread for each processor. */
+static int
+default_num_threads (void) {
+#if defined(DATAFILTER_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > FILTER_MAX_THREADS)
+        return FILTER_MAX_THREADS;
+    if (n > 1)
+        return (int) n;
+#endif
+    return 1;
+}
+
+static int
+filter_hash_files (lua_State *L) {
+    const AlgorithmDefinition *def;
+    Filter *model;
+    FileJob job;
+    FileResult *result;
+    const char *filename;
+    size_t filename_len;
+    int num_args = lua_gettop(L);
+    int options_pos = 0, threads = default_num_threads(), i;
+
+    if (num_args > 3)
+        return luaL_error(L, "too many arguments to datafilter.hash_files()");
+    luaL_checktype(L, 1, LUA_TTABLE);
+    def = find_algorithm(L, 2, 2);
+    if (num_args >= 3 && !lua_isnil(L, 3)) {
+        if (!lua_istable(L, 3))
+            return luaL_argerror(L, 3, "options must be either nil or a table");
+        options_pos = 3;
+        get_threads_option(L, options_pos, &threads);
+    }
+
+    /* The filenames stay referenced by the table while the threads use
+     * them, and nothing else gets a chance to change it. */
+    job.num_files = (int) lua_rawlen(L, 1);
+    job.next_file = 0;
+    job.filenames = lua_newuserdata(L, job.num_files * sizeof(const char *) +
+                                       1);
+    for (i = 0; i < job.num_files; ++i) {
+        lua_rawgeti(L, 1, i + 1);
+        if (lua_type(L, -1) != LUA_TSTRING)
+            return luaL_argerror(L, 1, "table should contain only filenames");
+        filename = lua_tolstring(L, -1, &filename_len);
+        luaL_argcheck(L, !contains_null_byte(filename, filename_len), 1,
+                      "invalid file name");
+        job.filenames[i] = filename;
+        lua_pop(L, 1);
+    }
+    job.results = lua_newuserdata(L, job.num_files * sizeof(FileResult) + 1);
+
+    /* Set up a filter with the options, for the threads to make copies of.
+     * It can't be used directly, because it uses the Lua allocator. */
+    model = lua_newuserdata(L, sizeof(Filter) + def->state_size);
+    if (!init_filter(model, L, def, options_pos)) {
+        destroy_filter(L, model);
+        return lua_error(L);
+    }
+    model->do_output = output_string;
+    job.model = model;
+
+    run_file_job(&job, threads);
+    destroy_filter(L, model);
+
+    /* Collect the results, freeing the output as we go. */
+    lua_createtable(L, 0, job.num_files);
+    lua_createtable(L, 0, 0);
+    for (i = 0; i < job.num_files; ++i) {
+        result = &job.results[i];
+        if (result->status == READ_FILE_OK) {
+            lua_pushlstring(L, (const char *) result->out, result->out_len);
+            lua_setfield(L, -3, job.filenames[i]);
+        }
+        else {
+            if (result->status == READ_FILE_ALGO_ERROR)
+                lua_pushstring(L, result->algo_error);
+            else
+                lua_pushfstring(L, read_file_error_format[result->status],
+                                job.filenames[i], strerror(result->err));
+            lua_setfield(L, -2, job.filenames[i]);
+        }
+        free(result->out);
+        result->out = 0;
+    }
+
+    return 2;
+}
+
+/* Push the output collected so far, as a string, or for a tee a table of
+ * strings keyed by algorithm name.  With 'take' true the output is removed
+ * from the buffers, so that it won't be returned again. */
+static void
+push_string_output (lua_State *L, Filter *filter, int take) {
+    Filter *branch;
+
+    if (filter->is_tee) {
+        lua_newtable(L);
+        for (branch = filter->next_stage; branch; branch = branch->next_stage) {
+            lua_pushlstring(L, (const char *) branch->buf_out,
+                            branch->buf_out_end - branch->buf_out);
+            lua_setfield(L, -2, branch->algo_name);
+            if (take)
+                branch->buf_out_end = branch->buf_out;
+        }
+        return;
+    }
+
+    filter = last_stage(filter);
+    lua_pushlstring(L, (const char *) filter->buf_out,
+                    filter->buf_out_end - filter->buf_out);
+    if (take)
+        filter->buf_out_end = filter->buf_out;
+}
+
 static int
 filter_result (lua_State *L) {
     Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+    Filter *last = last_stage(filter);
 
-    if (filter->do_output != output_string)
+    if (last->do_output != output_string)
         return luaL_error(L, "output sent elsewhere, not available as a"
                           " string");
 
+#ifdef DATAFILTER_ASYNC
+    if (filter->async && async_stop(L, filter)) {
+        filter_cleanup(L, filter);
+        return luaL_error(L, "%s", filter->error);
+    }
+#endif
+
     if (!filter->finished) {
-        if (do_filtering(filter, 1)) {
+        if (finish_filtering(filter)) {
             filter_cleanup(L, filter);
             return lua_error(L);
         }
         filter_finished_cleanup(L, filter);
     }
 
-    lua_pushlstring(L, (const char *) filter->buf_out,
-                    filter->buf_out_end - filter->buf_out);
+    push_string_output(L, filter, 0);
+    return 1;
+}
+
+/* Return the output collected so far, without finishing, and empty the
+ * buffer so that it can be reused for more. */
+static int
+filter_take (lua_State *L) {
+    Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+
+    Filter *stage;
+
+    if (last_stage(filter)->do_output != output_string)
+        return luaL_error(L, "output sent elsewhere, not available as a"
+                          " string");
+
+#ifdef DATAFILTER_ASYNC
+    /* The background thread has to catch up and stop writing output. */
+    if (filter->async) {
+        if (async_stop(L, filter)) {
+            filter_cleanup(L, filter);
+            return luaL_error(L, "%s", filter->error);
+        }
+        push_string_output(L, filter, 1);
+        async_start(L, filter, filter->async_size);
+        return 1;
+    }
+#endif
+
+    /* Output waiting in the buffers of earlier stages of a pipeline is
+     * passed on, so that whatever the last one can make of it is taken. */
+    if (!filter->is_tee && !filter->finished) {
+        for (stage = filter; stage->next_stage; stage = stage->next_stage) {
+            if (stage->buf_out_end == stage->buf_out)
+                continue;
+            if (filter_input(stage->next_stage, stage->buf_out,
+                             stage->buf_out_end - stage->buf_out))
+            {
+                filter_cleanup(L, filter);
+                return lua_error(L);
+            }
+            stage->buf_out_end = stage->buf_out;
+        }
+    }
+
+    push_string_output(L, filter, 1);
     return 1;
 }
 
@@ -652,7 +2423,14 @@ filter_finish (lua_State *L) {
     if (filter->finished)
         return luaL_error(L, "output has been finished");
 
-    if (do_filtering(filter, 1)) {
+#ifdef DATAFILTER_ASYNC
+    if (filter->async && async_stop(L, filter)) {
+        filter_cleanup(L, filter);
+        return luaL_error(L, "%s", filter->error);
+    }
+#endif
+
+    if (finish_filtering(filter)) {
         filter_cleanup(L, filter);
         return lua_error(L);
     }
@@ -661,9 +2439,285 @@ filter_finish (lua_State *L) {
     return 0;
 }
 
+/* Put the filter back to the state it was in when it was created, so that
+ * it can be used for some new input.  Any output which hasn't been passed
+ * on yet is discarded.  Output collected as a string can always be started
+ * again, but any other output destination is closed by finish() or by an
+ * error, and can't be reset after that. */
+static int
+filter_reset (lua_State *L) {
+    Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+    Filter *last = last_stage(filter), *stage;
+
+    if (last->do_output != output_string && !last->c_fh &&
+        last->output_func_ref == LUA_NOREF && last->l_fh_ref == LUA_NOREF)
+        return luaL_error(L, "output destination has been closed, can't"
+                          " reset filter");
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async)
+        async_stop(L, filter);
+#endif
+
+    for (stage = filter; stage; stage = stage->next_stage) {
+        memcpy(ALGO_STATE(stage), ALGO_INITIAL_STATE(stage),
+               stage->filter_object_size - sizeof(Filter));
+        stage->buf_in_end = stage->buf_in;
+        stage->buf_out_end = stage->buf_out;
+        stage->finished = 0;
+        stage->error = 0;
+    }
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async_option)
+        async_start(L, filter, filter->async_size);
+#endif
+
+    return 0;
+}
+
+/* The amount of memory taken up by one stage of a filter object, as laid
+ * out by create_filter_stages(). */
+static size_t
+object_stage_size (const Filter *stage) {
+    size_t size = 2 * stage->filter_object_size - sizeof(Filter);
+    return (size + FILTER_STAGE_ALIGN - 1) / FILTER_STAGE_ALIGN *
+           FILTER_STAGE_ALIGN;
+}
+
+static int
+copy_registry_ref (lua_State *L, int ref) {
+    if (ref == LUA_NOREF)
+        return LUA_NOREF;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+/* Make a new filter object which carries on from exactly where this one
+ * has got to, with its own copies of the algorithms' state, any input
+ * they haven't processed yet, and any output which hasn't been passed on.
+ * The copy sends its output to the same function or file handle object as
+ * the original, but it can't share a file opened from a filename. */
+static int
+filter_clone (lua_State *L) {
+    Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+    Filter *copy, *stage, *new_stage;
+    size_t size = 0, used;
+    int was_async = 0;
+
+    if (last_stage(filter)->c_fh)
+        return luaL_error(L, "can't clone a filter which is writing to a"
+                          " file opened by name");
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async) {
+        if (async_stop(L, filter)) {
+            filter_cleanup(L, filter);
+            return luaL_error(L, "%s", filter->error);
+        }
+        was_async = 1;
+    }
+#endif
+
+    for (stage = filter; stage; stage = stage->next_stage)
+        size += object_stage_size(stage);
+    copy = lua_newuserdata(L, size);
+    memcpy(copy, filter, size);
+
+    for (stage = filter; stage; stage = stage->next_stage) {
+        new_stage = (Filter *) (((char *) copy) +
+                                (((char *) stage) - ((char *) filter)));
+        if (stage->next_stage)
+            new_stage->next_stage = (Filter *) (((char *) copy) +
+                (((char *) stage->next_stage) - ((char *) filter)));
+        new_stage->L = L;
+
+        used = stage->buf_in_end - stage->buf_in;
+        new_stage->buf_in = stage->alloc(stage->alloc_ud, 0, 0,
+                                         stage->buf_in_size);
+        assert(new_stage->buf_in);
+        memcpy(new_stage->buf_in, stage->buf_in, used);
+        new_stage->buf_in_end = new_stage->buf_in + used;
+        new_stage->buf_in_free = 1;
+
+        used = stage->buf_out_end - stage->buf_out;
+        new_stage->buf_out = stage->alloc(stage->alloc_ud, 0, 0,
+                                          stage->buf_out_size);
+        assert(new_stage->buf_out);
+        memcpy(new_stage->buf_out, stage->buf_out, used);
+        new_stage->buf_out_end = new_stage->buf_out + used;
+
+        new_stage->output_func_ref = copy_registry_ref(L,
+                                                       stage->output_func_ref);
+        new_stage->l_fh_ref = copy_registry_ref(L, stage->l_fh_ref);
+        if (new_stage->clone_func)
+            new_stage->clone_func(new_stage);
+    }
+
+    luaL_getmetatable(L, FILTER_MT_NAME);
+    lua_setmetatable(L, -2);
+
+#ifdef DATAFILTER_ASYNC
+    if (was_async) {
+        async_start(L, filter, filter->async_size);
+        async_start(L, copy, copy->async_size);
+    }
+#else
+    (void) was_async;
+#endif
+
+    return 1;
+}
+
+static void
+add_uint32 (luaL_Buffer *b, uint32_t n) {
+    luaL_addchar(b, (char) (n >> 24));
+    luaL_addchar(b, (char) ((n >> 16) & 0xFF));
+    luaL_addchar(b, (char) ((n >> 8) & 0xFF));
+    luaL_addchar(b, (char) (n & 0xFF));
+}
+
+static uint32_t
+read_uint32 (const unsigned char *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) |
+           ((uint32_t) p[2] << 8) | (uint32_t) p[3];
+}
+
+/* Return a string from which import_state() can create a filter to carry
+ * on from where this one has got to. */
+static int
+filter_export_state (lua_State *L) {
+    Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+    const AlgorithmDefinition *def = filter_definition(filter);
+    uint32_t words[FILTER_STATE_MAX_WORDS];
+    size_t num_words, i;
+    luaL_Buffer b;
+
+    if (filter->next_stage)
+        return luaL_error(L, "can't export the state of a pipeline or tee");
+    if (!def->export_state)
+        return luaL_error(L, "algorithm '%s' can't export its state",
+                          def->name);
+    if (filter->finished)
+        return luaL_error(L, "output has been finished, no state to export");
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async) {
+        if (async_stop(L, filter)) {
+            filter_cleanup(L, filter);
+            return luaL_error(L, "%s", filter->error);
+        }
+        async_start(L, filter, filter->async_size);
+    }
+#endif
+
+    /* In async mode the input is only looked at by the background thread
+     * once it's been added, so the state and buffered input stay put. */
+    num_words = def->export_state(filter, words);
+    assert(num_words <= FILTER_STATE_MAX_WORDS);
+
+    luaL_buffinit(L, &b);
+    luaL_addlstring(&b, FILTER_STATE_MAGIC, sizeof(FILTER_STATE_MAGIC) - 1);
+    luaL_addchar(&b, FILTER_STATE_VERSION);
+    luaL_addchar(&b, (char) strlen(def->name));
+    luaL_addstring(&b, def->name);
+    luaL_addchar(&b, (char) num_words);
+    for (i = 0; i < num_words; ++i)
+        add_uint32(&b, words[i]);
+    add_uint32(&b, filter->buf_in_end - filter->buf_in);
+    luaL_addlstring(&b, (const char *) filter->buf_in,
+                    filter->buf_in_end - filter->buf_in);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* Like new(), but with the state of the algorithm loaded from the string
+ * given as the second argument, and the output and options following it. */
+static int
+filter_import_state (lua_State *L) {
+    const AlgorithmDefinition *def = find_algorithm(L, 2, 2);
+    size_t len, num_words, pending, i;
+    const unsigned char *p = (const unsigned char *)
+                             luaL_checklstring(L, 3, &len);
+    const unsigned char *end = p + len;
+    uint32_t words[FILTER_STATE_MAX_WORDS];
+    unsigned char input[FILTER_MIN_BUFFER_SIZE];
+    Filter *filter;
+
+    if (!def->import_state)
+        return luaL_error(L, "algorithm '%s' can't import state", def->name);
+
+    /* Copy everything out of the string before it's taken off the stack. */
+    if (len < sizeof(FILTER_STATE_MAGIC) + 1 ||
+        memcmp(p, FILTER_STATE_MAGIC, sizeof(FILTER_STATE_MAGIC) - 1))
+        return luaL_argerror(L, 3, "not state data from export_state()");
+    p += sizeof(FILTER_STATE_MAGIC) - 1;
+    if (*p++ != FILTER_STATE_VERSION)
+        return luaL_argerror(L, 3, "unsupported version of state data");
+    if ((size_t) (end - p) < (size_t) *p + 2 ||
+        *p != strlen(def->name) || memcmp(p + 1, def->name, *p))
+        return luaL_argerror(L, 3, "state data is for a different"
+                             " algorithm");
+    p += *p + 1;
+    num_words = *p++;
+    if (num_words > FILTER_STATE_MAX_WORDS ||
+        (size_t) (end - p) < num_words * 4 + 4)
+        return luaL_argerror(L, 3, "state data is truncated");
+    for (i = 0; i < num_words; ++i, p += 4)
+        words[i] = read_uint32(p);
+    pending = read_uint32(p);
+    p += 4;
+    if (pending > sizeof(input) || (size_t) (end - p) != pending)
+        return luaL_argerror(L, 3, "state data is corrupt");
+    memcpy(input, p, pending);
+
+    lua_remove(L, 3);
+    filter_new(L);
+    filter = lua_touserdata(L, -1);
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async)
+        async_stop(L, filter);
+#endif
+    if (!def->import_state(filter, words, num_words))
+        return luaL_error(L, "state data is corrupt");
+    memcpy(filter->buf_in, input, pending);
+    filter->buf_in_end = filter->buf_in + pending;
+#ifdef DATAFILTER_ASYNC
+    if (filter->async_option)
+        async_start(L, filter, filter->async_size);
+#endif
+
+    return 1;
+}
+
+static int
+filter_gc_flush (lua_State *L) {
+    filter_finished_cleanup(L, lua_touserdata(L, 1));
+    return 0;
+}
+
 static int
 filter_gc (lua_State *L) {
     Filter *filter = luaL_checkudata(L, 1, FILTER_MT_NAME);
+
+#ifdef DATAFILTER_ASYNC
+    if (filter->async)
+        async_stop(L, filter);
+#endif
+
+    /* Output which hasn't been finished is flushed in protected mode,
+     * because there's nobody to report an error to at this point, for
+     * example if a later stage of a pipeline rejects what it's given. */
+    if (!filter->finished) {
+        lua_pushcfunction(L, filter_gc_flush);
+        lua_pushlightuserdata(L, filter);
+        if (lua_pcall(L, 1, 0, 0)) {
+            lua_pop(L, 1);
+            filter_cleanup(L, filter);
+        }
+    }
+
     destroy_filter(L, filter);
     return 0;
 }
@@ -673,9 +2727,13 @@ luaopen_datafilter (lua_State *L) {
     size_t i;
     const AlgorithmDefinition *def;
 
+    detect_cpu_features();
+    crc32_make_tables();
+
     /* Reserve space for the simple algorithm functions (one per algo), and:
-     *  _NAME, _VERSION, .new() */
-    lua_createtable(L, 0, NUM_ALGO_DEFS + 3);
+     *  _NAME, _VERSION, .new(), .new_tee(), .md5_many(), .sha1_many(),
+     *  .hash_files(), .batch(), .import_state() */
+    lua_createtable(L, 0, NUM_ALGO_DEFS + 9);
 
     lua_pushliteral(L, "_NAME");
     lua_pushliteral(L, "datafilter");
@@ -694,6 +2752,24 @@ luaopen_datafilter (lua_State *L) {
     lua_pushliteral(L, "new");
     lua_pushcfunction(L, filter_new);
     lua_rawset(L, -3);
+    lua_pushliteral(L, "new_tee");
+    lua_pushcfunction(L, filter_new_tee);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "import_state");
+    lua_pushcfunction(L, filter_import_state);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "md5_many");
+    lua_pushcfunction(L, filter_md5_many);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "sha1_many");
+    lua_pushcfunction(L, filter_sha1_many);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "hash_files");
+    lua_pushcfunction(L, filter_hash_files);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "batch");
+    lua_pushcfunction(L, filter_batch);
+    lua_rawset(L, -3);
 
     /* Create the metatable for Filter objects returned from Filter:new() */
     luaL_newmetatable(L, FILTER_MT_NAME);
@@ -712,6 +2788,18 @@ luaopen_datafilter (lua_State *L) {
     lua_pushliteral(L, "finish");
     lua_pushcfunction(L, filter_finish);
     lua_rawset(L, -3);
+    lua_pushliteral(L, "reset");
+    lua_pushcfunction(L, filter_reset);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "take");
+    lua_pushcfunction(L, filter_take);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "clone");
+    lua_pushcfunction(L, filter_clone);
+    lua_rawset(L, -3);
+    lua_pushliteral(L, "export_state");
+    lua_pushcfunction(L, filter_export_state);
+    lua_rawset(L, -3);
     lua_pushliteral(L, "__gc");
     lua_pushcfunction(L, filter_gc);
     lua_rawset(L, -3);
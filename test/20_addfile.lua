@@ -20,6 +20,50 @@ function test_from_file ()
        "addfile() on random1.dat * 3")
 end
 
+function test_from_empty_or_special_file ()
+    local tmpname = os.tmpname()
+    assert(io.open(tmpname, "wb")):close()
+    local obj = Filter:new("md5")
+    obj:add("foo")
+    obj:addfile(tmpname)
+    is(Filter.md5("foo"), obj:result(), "addfile() on empty file")
+    assert(os.remove(tmpname))
+
+    -- Not a regular file, so can't be mapped into memory.
+    local fh = io.open("/dev/null", "rb")
+    if fh then
+        fh:close()
+        obj = Filter:new("md5")
+        obj:addfile("/dev/null")
+        is(Filter.md5(""), obj:result(), "addfile() on /dev/null")
+    end
+end
+
+function test_from_named_pipe ()
+    -- The file mustn't be opened twice, or the writer's data would be lost
+    -- and the second open would wait forever for another writer.
+    local tmpname = os.tmpname()
+    os.remove(tmpname)
+    local ok = os.execute("mkfifo " .. tmpname .. " 2>/dev/null")
+    if ok ~= true and ok ~= 0 then return end
+    os.execute("printf foobar > " .. tmpname .. " &")
+    local obj = Filter:new("md5")
+    obj:addfile(tmpname)
+    assert(os.remove(tmpname))
+    is(Filter.md5("foobar"), obj:result(), "addfile() on named pipe")
+end
+
+function test_from_file_partial_block_left_over ()
+    -- The end of the file is held back by the algorithm, and has to be
+    -- kept after the file is closed.
+    local data = read_file("test/data/random1.dat")
+    local obj = Filter:new("base64_encode")
+    obj:add("x")
+    obj:addfile("test/data/random1.dat")
+    obj:add("yz")
+    is(Filter.base64_encode("x" .. data .. "yz"), obj:result())
+end
+
 function test_mix_add_and_addfile ()
     local obj = Filter:new("md5")
     obj:add("string before the file")
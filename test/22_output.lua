@@ -186,3 +186,67 @@ function test_reusing_file_handle ()
     is("Zm9vYmFy\nZnJvYm5pdHo=\n", read_file(tmpname))
     assert(os.remove(tmpname))
 end
+
+function test_take ()
+    local obj = Filter:new("hex_lower")
+    is("", obj:take())
+    obj:add("foo")
+    is("666f6f", obj:take())
+    is("", obj:take())
+    obj:add("bar")
+    obj:add("baz")
+    is("6261", obj:take():sub(1, 4))
+    obj:add("x")
+    is("78", obj:result())
+    is("78", obj:take())
+    is("", obj:result())
+end
+
+function test_take_keeps_partial_input ()
+    -- Output which depends on input not seen yet isn't there until later.
+    local obj = Filter:new("base64_encode")
+    obj:add("foob")
+    is("Zm9v", obj:take())
+    obj:add("ar")
+    is("YmFy", obj:result())
+
+    local pieces = {}
+    obj = Filter:new("base64_encode")
+    for _ = 1, 8192 do
+        obj:add("abcdefghijkl")
+        pieces[#pieces + 1] = obj:take()
+    end
+    obj:finish()
+    pieces[#pieces + 1] = obj:take()
+    is(big_expected, table.concat(pieces))
+end
+
+function test_take_from_pipeline_and_tee ()
+    local obj = Filter:new({ "hex_lower", "hex_decode" })
+    obj:add("foo")
+    is("foo", obj:take())
+    obj:add("bar")
+    is("bar", obj:result())
+
+    obj = Filter:new_tee({ "hex_upper", "md5" })
+    obj:add("foo")
+    local got = obj:take()
+    is("666F6F", got.hex_upper)
+    is("", got.md5)
+    got = obj:result()
+    is("", got.hex_upper)
+    is(Filter.md5("foo"), got.md5)
+end
+
+function test_take_async ()
+    local obj = Filter:new("hex_upper", nil, { async = true })
+    obj:add("foo")
+    is("666F6F", obj:take())
+    obj:add("bar")
+    is("626172", obj:result())
+end
+
+function test_take_output_elsewhere ()
+    local obj = Filter:new("md5", function () end)
+    assert_error("output sent elsewhere", function () obj:take() end)
+end
@@ -70,3 +70,130 @@ function test_handle_init_error_oo ()
     assert_error("bad type for line_ending option",
                  function () Filter:new("base64_encode", nil, options) end)
 end
+
+function test_buffer_size_options ()
+    local input = ("abcdefghij"):rep(10000)
+    local expected = Filter.base64_encode(input)
+    for _, options in ipairs({
+        { buffer_size = 1024 }, { buffer_size = 100000 },
+        { input_buffer_size = 1500, output_buffer_size = 3000 },
+        { buffer_size = 2000, output_buffer_size = 5000.5 },
+    }) do
+        is(expected, Filter.base64_encode(input, options))
+
+        -- Output sent elsewhere comes in pieces no bigger than the buffer.
+        local chunks = {}
+        local obj = Filter:new("base64_encode",
+                               function (s) chunks[#chunks + 1] = s end,
+                               options)
+        obj:add(input)
+        obj:finish()
+        is(expected, table.concat(chunks))
+        local max = math.floor(options.output_buffer_size or
+                               options.buffer_size)
+        for _, s in ipairs(chunks) do assert(s:len() <= max) end
+        is(max, chunks[1]:len())
+    end
+end
+
+function test_input_buffer_size_option ()
+    local fh = { data = ("x"):rep(10000), requests = {} }
+    function fh:read (n)
+        self.requests[#self.requests + 1] = n
+        if self.data == "" then return nil end
+        local s = self.data:sub(1, n)
+        self.data = self.data:sub(n + 1)
+        return s
+    end
+    local obj = Filter:new("md5", nil, { input_buffer_size = 2500 })
+    obj:addfile(fh)
+    is(Filter.md5(("x"):rep(10000)), obj:result())
+    for _, n in ipairs(fh.requests) do assert(n <= 2500) end
+    is(2500, fh.requests[1])
+end
+
+function test_buffers_grow_automatically ()
+    -- Without a size given, the output is passed on in bigger and bigger
+    -- chunks when there's a lot of it.
+    local chunks = {}
+    local obj = Filter:new("hex_lower",
+                           function (s) chunks[#chunks + 1] = s:len() end)
+    for _ = 1, 100 do obj:add(("x"):rep(10000)) end
+    obj:finish()
+    local first, biggest = chunks[1], 0
+    for _, n in ipairs(chunks) do
+        if n > biggest then biggest = n end
+    end
+    assert(biggest >= first * 8,
+           "output buffer didn't grow (" .. first .. ", " .. biggest .. ")")
+end
+
+function test_bad_buffer_size_options ()
+    for _, name in ipairs({ "buffer_size", "input_buffer_size",
+                            "output_buffer_size" }) do
+        for _, value in ipairs({ "big", true, 0, 1023, -5, 2^40, 0/0 }) do
+            local options = { [name] = value }
+            assert_error("bad " .. name .. " " .. tostring(value),
+                         function () Filter.md5("foo", options) end)
+            assert_error("bad " .. name .. " " .. tostring(value) .. " (OO)",
+                         function () Filter:new("md5", nil, options) end)
+        end
+    end
+end
+
+function test_bad_buffer_size_with_destroy_func ()
+    -- An algorithm which frees things when it's destroyed shouldn't be
+    -- handed uninitialized state when a buffer size option is bad.
+    for _ = 1, 20 do
+        Filter:new("base64_encode", nil, { line_ending = "\r\n" })
+        Filter:new("qp_encode", nil, { line_ending = "\r\n" })
+        collectgarbage()
+        for _, algo in ipairs({ "base64_encode", "qp_encode" }) do
+            assert_error("bad buffer_size for " .. algo, function ()
+                Filter:new(algo, nil, { buffer_size = 1 })
+            end)
+            assert_error("bad buffer_size for " .. algo .. " (function)",
+                         function ()
+                Filter[algo]("foo", { buffer_size = 1 })
+            end)
+        end
+    end
+end
+
+function test_threads_option ()
+    -- Big enough to be split up between several threads, with some odd
+    -- bytes left over at the end.
+    local input = {}
+    for i = 0, 255 do input[#input + 1] = string.char(i) end
+    input = table.concat(input):rep(4100) .. "xy"
+    local b64 = Filter.base64_encode(input)
+    for _, threads in ipairs({ 1, 2, 3, 8 }) do
+        local function check (algo, data, options)
+            options = options or {}
+            local expected = Filter[algo](data, options)
+            options.threads = threads
+            is(expected, Filter[algo](data, options), algo .. " " .. threads)
+        end
+        check("hex_lower", input)
+        check("hex_upper", input)
+        check("percent_encode", input)
+        check("base64_encode", input)
+        check("base64_encode", input, { max_line_length = 7,
+                                        line_ending = "\n" })
+        check("base64_decode", b64)
+        check("base64_decode", b64:sub(1, -3) .. "\n==")
+    end
+    is(input, Filter.base64_decode(b64, { threads = 4 }))
+    assert_error("bad base64 split up", function ()
+        Filter.base64_decode(b64:sub(1, 9999) .. "!" .. b64:sub(10001),
+                             { threads = 4 })
+    end)
+end
+
+function test_bad_threads_option ()
+    for _, value in ipairs({ "lots", true, 0, -1, 65, 0/0 }) do
+        assert_error("bad threads " .. tostring(value), function ()
+            Filter.hex_lower("foo", { threads = value })
+        end)
+    end
+end
@@ -0,0 +1,86 @@
+local _ENV = TEST_CASE "test.pipeline"
+
+local input = ("The quick brown fox jumps over the lazy dog.\n"):rep(500)
+
+function test_single_stage ()
+    local obj = Filter:new({ "base64_encode" })
+    obj:add("foobar")
+    is("Zm9vYmFy", obj:result())
+end
+
+function test_decode_then_hash ()
+    local obj = Filter:new({ "base64_decode", "sha1" })
+    obj:add(Filter.base64_encode(input))
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(obj:result()))
+end
+
+function test_round_trip_in_small_pieces ()
+    local obj = Filter:new({ "qp_encode", "qp_decode", "hex_lower",
+                             "hex_decode", "percent_encode",
+                             "percent_decode" })
+    for i = 1, input:len(), 7 do obj:add(input:sub(i, i + 6)) end
+    is(input, obj:result())
+end
+
+function test_output_only_from_last_stage ()
+    local got = {}
+    local obj = Filter:new({ "hex_lower", "base64_encode" },
+                           function (s) got[#got + 1] = s end)
+    obj:add(input)
+    obj:finish()
+    is(Filter.base64_encode(Filter.hex_lower(input)), table.concat(got))
+    assert_error("output sent elsewhere", function () obj:result() end)
+end
+
+function test_addfile ()
+    local obj = Filter:new({ "base64_encode", "base64_decode", "md5" })
+    obj:addfile("test/data/random1.dat")
+    is(bytes_to_hex(Filter.md5(read_file("test/data/random1.dat"))),
+       bytes_to_hex(obj:result()))
+end
+
+function test_stage_options ()
+    local obj = Filter:new({ { "base64_encode", { max_line_length = 4 } },
+                             "hex_upper" },
+                           nil, { line_ending = "\n" })
+    obj:add("foobar")
+    is(Filter.hex_upper("Zm9v\r\nYmFy\r\n"), obj:result())
+
+    -- Options given for all the stages.
+    obj = Filter:new({ "base64_encode", "base64_encode" }, nil,
+                     { max_line_length = 8, line_ending = "\n" })
+    obj:add("foobar")
+    is("Wm05dllt\nRnkK\n", obj:result())
+end
+
+function test_finish_flushes_all_stages ()
+    -- The first stage only produces output at the end of its input, and
+    -- the second has to be told about the end of its input after that.
+    local obj = Filter:new({ "md5", "base64_encode" })
+    obj:add(input)
+    is(Filter.base64_encode(Filter.md5(input)), obj:result())
+end
+
+function test_bad_stages ()
+    assert_error("empty list", function () Filter:new({}) end)
+    assert_error("unknown algorithm",
+                 function () Filter:new({ "base64_encode", "foo" }) end)
+    assert_error("name not string",
+                 function () Filter:new({ "md5", {} }) end)
+    assert_error("bad stage options",
+                 function () Filter:new({ { "md5", 23 } }) end)
+    assert_error("bad option in later stage", function ()
+        Filter:new({ "md5", { "base64_encode", { max_line_length = -1 } } })
+    end)
+end
+
+function test_error_in_later_stage ()
+    local obj = Filter:new({ "base64_encode", "hex_decode" })
+    obj:add("foo")
+    assert_error("not hex at end", function () obj:result() end)
+
+    -- An error while the output of the first stage is being passed on.
+    obj = Filter:new({ "base64_encode", "hex_decode" })
+    assert_error("not hex while adding",
+                 function () obj:add(("foo"):rep(10000)) end)
+end
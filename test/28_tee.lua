@@ -0,0 +1,75 @@
+local _ENV = TEST_CASE "test.tee"
+
+local input = ("The quick brown fox jumps over the lazy dog.\n"):rep(1000)
+
+local function check_results (got, input)
+    is(bytes_to_hex(Filter.md5(input)), bytes_to_hex(got.md5))
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(got.sha1))
+    is(bytes_to_hex(Filter.adler32(input)), bytes_to_hex(got.adler32))
+end
+
+function test_digests ()
+    local obj = Filter:new_tee({ "md5", "sha1", "adler32" })
+    obj:add(input)
+    local got = obj:result()
+    is("table", type(got))
+    check_results(got, input)
+
+    -- Asking again gives the same answers.
+    check_results(obj:result(), input)
+end
+
+function test_empty_input ()
+    local obj = Filter:new_tee({ "md5", "sha1", "adler32" })
+    check_results(obj:result(), "")
+end
+
+function test_input_in_small_pieces ()
+    local obj = Filter:new_tee({ "md5", "sha1", "adler32" })
+    for i = 1, input:len(), 13 do obj:add(input:sub(i, i + 12)) end
+    check_results(obj:result(), input)
+end
+
+function test_addfile ()
+    local obj = Filter:new_tee({ "sha1", "md5", "adler32" })
+    obj:addfile("test/data/random1.dat")
+    check_results(obj:result(), read_file("test/data/random1.dat"))
+end
+
+function test_finish_then_result ()
+    local obj = Filter:new_tee({ "md5", "sha1", "adler32" })
+    obj:add("foo")
+    obj:finish()
+    check_results(obj:result(), "foo")
+    assert_error("add after finish", function () obj:add("bar") end)
+end
+
+function test_other_algorithms_and_options ()
+    local obj = Filter:new_tee({ "hex_upper",
+                                 { "base64_encode", { max_line_length = 8,
+                                                      line_ending = "\n" } },
+                                 "md5" })
+    obj:add("foobarbaz")
+    local got = obj:result()
+    is("666F6F62617262617A", got.hex_upper)
+    is("Zm9vYmFy\nYmF6\n", got.base64_encode)
+    is(bytes_to_hex(Filter.md5("foobarbaz")), bytes_to_hex(got.md5))
+end
+
+function test_error_in_branch ()
+    local obj = Filter:new_tee({ "md5", "hex_decode" })
+    assert_error("bad hex", function () obj:add("xyz") end)
+end
+
+function test_bad_usage ()
+    assert_error("not a table", function () Filter:new_tee("md5") end)
+    assert_error("empty list", function () Filter:new_tee({}) end)
+    assert_error("unknown algorithm",
+                 function () Filter:new_tee({ "md5", "foo" }) end)
+    assert_error("duplicate algorithm",
+                 function () Filter:new_tee({ "md5", "sha1", "md5" }) end)
+    assert_error("bad options",
+                 function () Filter:new_tee({ "md5" }, "foo") end)
+    assert_error("too many args",
+                 function () Filter:new_tee({ "md5" }, nil, nil) end)
+end
@@ -0,0 +1,82 @@
+local _ENV = TEST_CASE "test.hash_files"
+
+local function write_file (filename, data)
+    local fh = assert(io.open(filename, "wb"))
+    fh:write(data)
+    fh:close()
+end
+
+function test_hash_files ()
+    local files, expected = {}, {}
+    for i = 1, 20 do
+        local name = os.tmpname()
+        local data = ("file " .. i .. "\n"):rep(i * 997)
+        write_file(name, data)
+        files[i] = name
+        expected[name] = Filter.sha1(data)
+    end
+    files[#files + 1] = "test/data/random1.dat"
+    expected["test/data/random1.dat"] =
+        Filter.sha1(read_file("test/data/random1.dat"))
+
+    for _, threads in ipairs({ 1, 3, 64 }) do
+        local got, errors = Filter.hash_files(files, "sha1",
+                                              { threads = threads })
+        is(nil, next(errors))
+        for _, name in ipairs(files) do
+            is(bytes_to_hex(expected[name]), bytes_to_hex(got[name]))
+        end
+    end
+
+    for i = 1, 20 do assert(os.remove(files[i])) end
+end
+
+function test_other_algorithms_and_options ()
+    local name = os.tmpname()
+    write_file(name, "foobar")
+    local got = Filter.hash_files({ name }, "base64_encode",
+                                  { max_line_length = 4, line_ending = "\n" })
+    is("Zm9v\nYmFy\n", got[name])
+    got = Filter.hash_files({ name, name }, "md5")
+    is(bytes_to_hex(Filter.md5("foobar")), bytes_to_hex(got[name]))
+    assert(os.remove(name))
+end
+
+function test_empty_list_and_file ()
+    local got, errors = Filter.hash_files({}, "md5")
+    is(nil, next(got))
+    is(nil, next(errors))
+
+    got, errors = Filter.hash_files({ "/dev/null" }, "adler32")
+    is(bytes_to_hex(Filter.adler32("")), bytes_to_hex(got["/dev/null"]))
+    is(nil, next(errors))
+end
+
+function test_errors_per_file ()
+    local name = os.tmpname()
+    write_file(name, "not hex")
+    local missing = "test/data/no-such-file"
+    local got, errors = Filter.hash_files({ name, missing, "test" },
+                                          "hex_decode")
+    is(nil, next(got))
+    assert_match("^error opening file 'test/data/no%-such%-file': ",
+                 errors[missing])
+    assert_match("not hex digit", errors[name])
+    assert_match("^error reading from file 'test': ", errors["test"])
+    assert(os.remove(name))
+end
+
+function test_bad_usage ()
+    assert_error("no list", function () Filter.hash_files(nil, "md5") end)
+    assert_error("bad name",
+                 function () Filter.hash_files({ "foo", 23 }, "md5") end)
+    assert_error("bad algorithm",
+                 function () Filter.hash_files({}, "md6") end)
+    assert_error("bad options",
+                 function () Filter.hash_files({}, "md5", "foo") end)
+    assert_error("bad threads",
+                 function () Filter.hash_files({}, "md5", { threads = 0 }) end)
+    assert_error("bad algorithm option", function ()
+        Filter.hash_files({}, "base64_encode", { max_line_length = 0 })
+    end)
+end
@@ -0,0 +1,95 @@
+local _ENV = TEST_CASE "test.async"
+
+local input = ("The quick brown fox jumps over the lazy dog.\n"):rep(1000)
+
+function test_string_result ()
+    local obj = Filter:new("sha1", nil, { async = true })
+    obj:add(input)
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(obj:result()))
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(obj:result()))
+
+    obj = Filter:new("base64_encode", nil, { async = true })
+    is("", obj:result())
+end
+
+function test_output_filename ()
+    local tmpname = os.tmpname()
+    local obj = Filter:new("hex_lower", tmpname, { async = true })
+    obj:add("foo")
+    obj:add(input)
+    obj:finish()
+    is(Filter.hex_lower("foo" .. input), read_file(tmpname))
+    assert(os.remove(tmpname))
+end
+
+function test_input_bigger_than_ring ()
+    -- Each piece added wraps round the ring more than once, and the small
+    -- pieces wrap at odd places.
+    local obj = Filter:new("base64_encode", nil,
+                           { async = true, async_buffer_size = 1024 })
+    obj:add(input)
+    for i = 1, input:len(), 333 do obj:add(input:sub(i, i + 332)) end
+    is(Filter.base64_encode(input .. input), obj:result())
+end
+
+function test_addfile ()
+    local data = read_file("test/data/random1.dat")
+    local obj = Filter:new("md5", nil, { async = true })
+    obj:add(input)
+    obj:addfile("test/data/random1.dat")
+    obj:add(input)
+    is(bytes_to_hex(Filter.md5(input .. data .. input)),
+       bytes_to_hex(obj:result()))
+end
+
+function test_addfile_error ()
+    local obj = Filter:new("hex_lower", nil, { async = true })
+    obj:add("foo")
+    assert_error("missing file", function ()
+        obj:addfile("test/data/no-such-file.dat")
+    end)
+    obj:add("bar")
+    is(Filter.hex_lower("foobar"), obj:result())
+
+    -- Still in async mode, which can be seen from a bad input not being
+    -- reported straight away.  That can't happen if async mode isn't
+    -- supported at all.
+    local probe = Filter:new("hex_decode", nil, { async = true })
+    if not pcall(probe.add, probe, "x") then return end
+    obj = Filter:new("hex_decode", nil, { async = true })
+    assert_error("missing file", function ()
+        obj:addfile("test/data/no-such-file.dat")
+    end)
+    assert(pcall(obj.add, obj, "x"), "error reported straight away")
+    assert_error("bad hex reported later", function () obj:finish() end)
+end
+
+function test_error_reported_later ()
+    local obj = Filter:new("hex_decode", nil, { async = true })
+    obj:add("4142")
+    assert_error("bad hex", function ()
+        -- The error might not be seen until a later call.
+        obj:add("xyz")
+        for _ = 1, 100 do obj:add("41") end
+        obj:finish()
+    end)
+
+    obj = Filter:new("hex_decode", nil, { async = true })
+    obj:add("414")
+    assert_error("odd number of digits", function () obj:result() end)
+end
+
+function test_bad_usage ()
+    assert_error("function output", function ()
+        Filter:new("md5", function () end, { async = true })
+    end)
+    assert_error("pipeline", function ()
+        Filter:new({ "md5", "hex_lower" }, nil, { async = true })
+    end)
+    assert_error("tee", function ()
+        Filter:new_tee({ "md5", "sha1" }, { async = true })
+    end)
+    assert_error("bad ring size", function ()
+        Filter:new("md5", nil, { async = true, async_buffer_size = 1 })
+    end)
+end
@@ -0,0 +1,95 @@
+local _ENV = TEST_CASE "test.reset"
+
+local input = ("The quick brown fox jumps over the lazy dog.\n"):rep(1000)
+
+function test_hash_several_messages ()
+    local obj = Filter:new("md5")
+    for _, msg in ipairs({ "foo", input, "", "bar" }) do
+        obj:add(msg)
+        is(bytes_to_hex(Filter.md5(msg)), bytes_to_hex(obj:result()))
+        obj:reset()
+    end
+end
+
+function test_reset_before_finishing ()
+    local obj = Filter:new("sha1")
+    obj:add("some input to be forgotten")
+    obj:reset()
+    obj:add(input)
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(obj:result()))
+end
+
+function test_options_kept ()
+    local obj = Filter:new("base64_encode", nil,
+                           { max_line_length = 4, line_ending = "\n" })
+    obj:add("foobar")
+    is("Zm9v\nYmFy\n", obj:result())
+    obj:reset()
+    obj:add("bazqux")
+    is("YmF6\ncXV4\n", obj:result())
+end
+
+function test_after_error ()
+    local obj = Filter:new("hex_decode")
+    assert_error("bad hex", function () obj:add("xyz") end)
+    obj:reset()
+    obj:add("41")
+    is("A", obj:result())
+
+    obj = Filter:new("base64_decode")
+    obj:add("Zm9")
+    assert_error("incomplete base64", function () obj:result() end)
+    obj:reset()
+    obj:add("Zm9v")
+    is("foo", obj:result())
+end
+
+function test_pipeline_and_tee ()
+    local obj = Filter:new({ "base64_encode", "base64_decode", "md5" })
+    obj:add(input)
+    obj:result()
+    obj:reset()
+    obj:add("foo")
+    is(bytes_to_hex(Filter.md5("foo")), bytes_to_hex(obj:result()))
+
+    obj = Filter:new_tee({ "md5", "sha1" })
+    obj:add(input)
+    obj:result()
+    obj:reset()
+    obj:add("foo")
+    local got = obj:result()
+    is(bytes_to_hex(Filter.md5("foo")), bytes_to_hex(got.md5))
+    is(bytes_to_hex(Filter.sha1("foo")), bytes_to_hex(got.sha1))
+end
+
+function test_function_output ()
+    local got = {}
+    local obj = Filter:new("hex_lower", function (s) got[#got + 1] = s end)
+    obj:add("discarded")
+    obj:reset()
+    obj:add("foo")
+    obj:finish()
+    is("666f6f", table.concat(got))
+    assert_error("function closed by finish", function () obj:reset() end)
+end
+
+function test_file_output ()
+    local tmpname = os.tmpname()
+    local obj = Filter:new("hex_upper", tmpname)
+    obj:add("foo")
+    obj:finish()
+    is("666F6F", read_file(tmpname))
+    assert_error("file closed by finish", function () obj:reset() end)
+    assert(os.remove(tmpname))
+end
+
+function test_async ()
+    local obj = Filter:new("sha1", nil,
+                           { async = true, async_buffer_size = 1024 })
+    obj:add(input)
+    is(bytes_to_hex(Filter.sha1(input)), bytes_to_hex(obj:result()))
+    obj:reset()
+    obj:add(input:sub(1, 5000))
+    is(bytes_to_hex(Filter.sha1(input:sub(1, 5000))),
+       bytes_to_hex(obj:result()))
+end
@@ -0,0 +1,106 @@
+local _ENV = TEST_CASE "test.clone"
+
+local prefix = ("The quick brown fox jumps over the lazy dog.\n"):rep(500)
+
+function test_shared_prefix ()
+    local obj = Filter:new("sha1")
+    obj:add(prefix)
+    for _, body in ipairs({ "", "foo", prefix }) do
+        local copy = obj:clone()
+        copy:add(body)
+        is(bytes_to_hex(Filter.sha1(prefix .. body)),
+           bytes_to_hex(copy:result()))
+    end
+
+    -- The original isn't affected.
+    obj:add("bar")
+    is(bytes_to_hex(Filter.sha1(prefix .. "bar")), bytes_to_hex(obj:result()))
+end
+
+function test_digest_so_far ()
+    local obj = Filter:new("md5")
+    obj:add("foo")
+    is(bytes_to_hex(Filter.md5("foo")), bytes_to_hex(obj:clone():result()))
+    obj:add("bar")
+    is(bytes_to_hex(Filter.md5("foobar")), bytes_to_hex(obj:result()))
+end
+
+function test_pending_input_and_output ()
+    -- Part of a Base64 group is held back as input, and the output so far
+    -- is copied too.
+    local obj = Filter:new("base64_decode")
+    obj:add("Zm9vYm")
+    local copy = obj:clone()
+    obj:add("Fy")
+    copy:add("F6")
+    is("foobar", obj:result())
+    is("foobaz", copy:result())
+end
+
+function test_line_ending_option_copied ()
+    local obj = Filter:new("base64_encode", nil,
+                           { max_line_length = 4, line_ending = "|" })
+    obj:add("foob")
+    local copy = obj:clone()
+    obj = nil
+    collectgarbage()
+    copy:add("ar")
+    is("Zm9v|YmFy|", copy:result())
+    copy:reset()
+    copy:add("foo")
+    is("Zm9v|", copy:result())
+
+    obj = Filter:new("qp_encode", nil, { line_ending = "\n" })
+    obj:add("foo\r\n")
+    copy = obj:clone()
+    is("foo\n", copy:result())
+    is("foo\n", obj:result())
+end
+
+function test_pipeline_and_tee ()
+    local obj = Filter:new({ "hex_lower", "hex_decode", "md5" })
+    obj:add("foo")
+    local copy = obj:clone()
+    copy:add("bar")
+    is(bytes_to_hex(Filter.md5("foobar")), bytes_to_hex(copy:result()))
+    is(bytes_to_hex(Filter.md5("foo")), bytes_to_hex(obj:result()))
+
+    obj = Filter:new_tee({ "md5", "hex_upper" })
+    obj:add("foo")
+    copy = obj:clone()
+    copy:add("bar")
+    local got = copy:result()
+    is(bytes_to_hex(Filter.md5("foobar")), bytes_to_hex(got.md5))
+    is("666F6F626172", got.hex_upper)
+    is("666F6F", obj:result().hex_upper)
+end
+
+function test_function_output ()
+    local got = {}
+    local obj = Filter:new("hex_lower", function (s) got[#got + 1] = s end)
+    obj:add("foo")
+    local copy = obj:clone()
+    obj = nil
+    collectgarbage()
+    copy:add("bar")
+    copy:finish()
+    is("666f6f" .. "666f6f626172", table.concat(got))
+end
+
+function test_async ()
+    local obj = Filter:new("sha1", nil, { async = true })
+    obj:add(prefix)
+    local copy = obj:clone()
+    copy:add("foo")
+    obj:add("bar")
+    is(bytes_to_hex(Filter.sha1(prefix .. "foo")), bytes_to_hex(copy:result()))
+    is(bytes_to_hex(Filter.sha1(prefix .. "bar")), bytes_to_hex(obj:result()))
+end
+
+function test_file_output ()
+    local tmpname = os.tmpname()
+    local obj = Filter:new("md5", tmpname)
+    assert_error("can't share a file", function () obj:clone() end)
+    obj:finish()
+    assert(os.remove(tmpname))
+end
@@ -0,0 +1,66 @@
+local _ENV = TEST_CASE "test.small_input"
+
+-- Small inputs to the simple functions are dealt with differently from big
+-- ones, so check that they give the same results as the OO API, for sizes
+-- either side of the cut-off point.
+local function oo_result (name, input, options)
+    local obj = Filter:new(name, nil, options)
+    obj:add(input)
+    return obj:result()
+end
+
+local function check_algorithm (name, input, options, lengths)
+    lengths = lengths or { 0, 1, 15, 16, 17, 1023, 1024, 1025, 1500 }
+    for _, len in ipairs(lengths) do
+        local s = input:sub(1, len)
+        is(oo_result(name, s, options), Filter[name](s, options),
+           name .. " on " .. len .. " bytes")
+    end
+end
+
+local text = ("The quick brown fox = jumps over the lazy dog.\r\n"):rep(40)
+
+function test_encoders_and_hashes ()
+    for _, name in ipairs({ "base64_encode", "hex_lower", "hex_upper",
+                            "percent_encode", "qp_encode", "md5", "sha1",
+                            "sha256", "adler32" })
+    do
+        check_algorithm(name, text)
+    end
+end
+
+function test_decoders ()
+    check_algorithm("base64_decode", Filter.base64_encode(text), nil,
+                    { 0, 4, 16, 1020, 1024, 1028, 1500 })
+    check_algorithm("hex_decode", Filter.hex_lower(text), nil,
+                    { 0, 2, 16, 1022, 1024, 1026, 1500 })
+    check_algorithm("percent_decode", text)
+    check_algorithm("qp_decode", Filter.qp_encode(text))
+end
+
+function test_options ()
+    check_algorithm("base64_encode", text,
+                    { max_line_length = 3, line_ending = "\n" })
+    check_algorithm("qp_encode", text, { line_ending = "\n" })
+end
+
+function test_output_bigger_than_first_buffer ()
+    -- Each byte becomes an escape sequence plus a soft line break now and
+    -- then, so the output is several times the size of the input.
+    local input = ("\255"):rep(1024)
+    is(oo_result("qp_encode", input), Filter.qp_encode(input))
+    is(oo_result("base64_encode", input, { max_line_length = 1 }),
+       Filter.base64_encode(input, { max_line_length = 1 }))
+end
+
+function test_errors ()
+    assert_error("bad hex", function () Filter.hex_decode("4x") end)
+    assert_error("bad option",
+                 function () Filter.base64_encode("foo", { line_ending = {} })
+                 end)
+    -- The line ending has already been copied when this goes wrong, and
+    -- has to be freed.
+    assert_error("bad option after one which allocates", function ()
+        Filter.base64_encode("foo", { line_ending = "x", max_line_length = 0 })
+    end)
+end
@@ -0,0 +1,100 @@
+local _ENV = TEST_CASE "test.export_state"
+
+local input = ("The quick brown fox jumps over the lazy dog.\n"):rep(300)
+
+local function resume (name, first, second)
+    local obj = Filter:new(name)
+    obj:add(first)
+    local state = obj:export_state()
+    is("string", type(state))
+
+    -- Exporting doesn't change anything.
+    obj:add(second)
+    is(Filter[name](first .. second), obj:result())
+
+    obj = Filter:import_state(name, state)
+    obj:add(second)
+    return obj:result()
+end
+
+function test_resume_hashes ()
+    for _, name in ipairs({ "md5", "sha1", "sha256", "adler32", "crc32",
+                            "crc32c" })
+    do
+        -- Split at block boundaries and at odd places, so that sometimes
+        -- there's input which hasn't been processed yet.
+        for _, pos in ipairs({ 0, 1, 63, 64, 65, 1000, input:len() }) do
+            is(Filter[name](input), resume(name, input:sub(1, pos),
+                                           input:sub(pos + 1)),
+               name .. " split at " .. pos)
+        end
+    end
+end
+
+function test_resume_several_times ()
+    local obj = Filter:new("sha1")
+    for i = 1, input:len(), 1000 do
+        obj:add(input:sub(i, i + 999))
+        obj = Filter:import_state("sha1", obj:export_state())
+    end
+    is(Filter.sha1(input), obj:result())
+end
+
+function test_import_with_output_and_options ()
+    local obj = Filter:new("md5")
+    obj:add("foo")
+    local got
+    obj = Filter:import_state("md5", obj:export_state(),
+                              function (s) got = s end,
+                              { buffer_size = 2048 })
+    obj:add("bar")
+    obj:finish()
+    is(Filter.md5("foobar"), got)
+end
+
+function test_async ()
+    local obj = Filter:new("sha1", nil, { async = true })
+    obj:add(input)
+    local state = obj:export_state()
+    obj = Filter:import_state("sha1", state, nil, { async = true })
+    obj:add("foo")
+    is(Filter.sha1(input .. "foo"), obj:result())
+end
+
+function test_export_errors ()
+    assert_error("not exportable",
+                 function () Filter:new("hex_lower"):export_state() end)
+    assert_error("pipeline", function ()
+        Filter:new({ "md5", "hex_lower" }):export_state()
+    end)
+    assert_error("tee",
+                 function () Filter:new_tee({ "md5" }):export_state() end)
+    local obj = Filter:new("md5")
+    obj:finish()
+    assert_error("finished", function () obj:export_state() end)
+end
+
+function test_import_errors ()
+    local obj = Filter:new("md5")
+    obj:add("foo")
+    local state = obj:export_state()
+    assert_error("different algorithm",
+                 function () Filter:import_state("sha1", state) end)
+    assert_error("not exportable",
+                 function () Filter:import_state("hex_lower", state) end)
+    assert_error("unknown algorithm",
+                 function () Filter:import_state("foo", state) end)
+    assert_error("not state data",
+                 function () Filter:import_state("md5", "foobar") end)
+    assert_error("truncated", function ()
+        Filter:import_state("md5", state:sub(1, -2))
+    end)
+    assert_error("extra data", function ()
+        Filter:import_state("md5", state .. "x")
+    end)
+    assert_error("wrong version", function ()
+        Filter:import_state("md5", "DFS\2" .. state:sub(5))
+    end)
+    assert_error("missing state",
+                 function () Filter:import_state("md5") end)
+end
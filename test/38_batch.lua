@@ -0,0 +1,70 @@
+local _ENV = TEST_CASE "test.batch"
+
+local inputs = { "", "foo", "foobar",
+                 ("The quick brown fox jumps over the lazy dog.\n"):rep(100) }
+
+local function check_batch (name, list, options)
+    local got = Filter.batch(name, list, options)
+    is(#list, #got)
+    for i, s in ipairs(list) do
+        is(Filter[name](s, options), got[i], name .. " item " .. i)
+    end
+end
+
+function test_every_algorithm ()
+    for _, name in ipairs({ "adler32", "base64_encode", "hex_lower",
+                            "hex_upper", "md5", "percent_encode",
+                            "qp_encode", "sha1" })
+    do
+        check_batch(name, inputs)
+    end
+
+    check_batch("base64_decode", { "", "Zm9v", "Zm9vYmFy", "Zm8=" })
+    check_batch("hex_decode", { "", "41", "666f6f" })
+    check_batch("percent_decode", { "", "foo%20bar", "%41" })
+    check_batch("qp_decode", { "", "foo=20bar", "=41=\r\nB" })
+end
+
+function test_options ()
+    check_batch("base64_encode", inputs,
+                { max_line_length = 8, line_ending = "\n" })
+    check_batch("md5", inputs, {})
+    check_batch("sha1", inputs, { buffer_size = 1024 })
+end
+
+function test_state_not_carried_over ()
+    -- An incomplete line or escape at the end of one string mustn't affect
+    -- the next one.
+    local got = Filter.batch("base64_encode", { "abcde", "f" },
+                             { max_line_length = 4 })
+    is("YWJj\r\nZGU=\r\n", got[1])
+    is("Zg==\r\n", got[2])
+end
+
+function test_empty_list ()
+    local got = Filter.batch("hex_lower", {})
+    is("table", type(got))
+    is(0, #got)
+end
+
+function test_errors ()
+    assert_error("unknown algorithm",
+                 function () Filter.batch("foo", { "bar" }) end)
+    assert_error("list not table",
+                 function () Filter.batch("md5", "foo") end)
+    assert_error("non-string item",
+                 function () Filter.batch("md5", { "foo", 23, true }) end)
+    assert_error("non-string item, generic path",
+                 function () Filter.batch("hex_lower", { "foo", {} }) end)
+    assert_error("bad options",
+                 function () Filter.batch("md5", { "foo" }, "bar") end)
+    assert_error("bad algorithm option", function ()
+        Filter.batch("base64_encode", { "foo" }, { max_line_length = 0 })
+    end)
+    assert_error("too many args",
+                 function () Filter.batch("md5", { "foo" }, nil, nil) end)
+
+    local ok, err = pcall(Filter.batch, "hex_decode", { "41", "4x" })
+    is(false, ok)
+    assert_match("string 2", err)
+end
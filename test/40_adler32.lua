@@ -305,3 +305,34 @@ function test_gradual_size_increase ()
            "Adler32 of " .. string.format("%q", input))
     end
 end
+
+-- Straightforward implementation to check the optimized one against.
+local function slow_adler32 (input)
+    local s1, s2 = 1, 0
+    for i = 1, input:len() do
+        s1 = (s1 + input:byte(i)) % 65521
+        s2 = (s2 + s1) % 65521
+    end
+    return string.format("%04x%04x", s2, s1)
+end
+
+function test_big_input ()
+    local inputs = {
+        read_file("test/data/random1.dat"):rep(100),
+        ("\255"):rep(5552 * 3 + 31),
+    }
+    for _, input in ipairs(inputs) do
+        local expected = slow_adler32(input)
+        is(expected, bytes_to_hex(Filter.adler32(input)),
+           "Adler32 of " .. input:len() .. " bytes")
+
+        local obj = Filter:new("adler32")
+        local pos = 1
+        while pos <= input:len() do
+            obj:add(input:sub(pos, pos + 1000))
+            pos = pos + 1001
+        end
+        is(expected, bytes_to_hex(obj:result()),
+           "Adler32 of " .. input:len() .. " bytes, added in chunks")
+    end
+end
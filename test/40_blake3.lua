@@ -0,0 +1,149 @@
+local _ENV = TEST_CASE "test.blake3"
+
+-- Test vectors from the official BLAKE3 test suite, where the input is
+-- bytes counting up from zero and wrapping round after 250, for each of
+-- these lengths.
+local function test_input (len)
+    local bytes = {}
+    for i = 1, len do bytes[i] = string.char((i - 1) % 251) end
+    return table.concat(bytes)
+end
+
+local expected = {
+    [0] = "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262",
+    [1] = "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213",
+    [1023] = "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11",
+    [1024] = "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7",
+    [1025] = "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444",
+    [2048] = "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a",
+    [2049] = "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030",
+    [3072] = "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2",
+    [3073] = "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3",
+    [4096] = "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969",
+    [4097] = "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995",
+    [5120] = "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833",
+    [5121] = "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff",
+    [6144] = "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205",
+    [6145] = "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f",
+    [7168] = "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a",
+    [7169] = "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817",
+    [8192] = "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63",
+    [8193] = "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b",
+    [16384] = "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4",
+    [31744] = "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47",
+    [102400] = "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085",
+}
+
+-- The same, but with 131 bytes of output.
+local expected_long = {
+    [0] =
+        "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" ..
+        "e00f03e7b69af26b7faaf09fcd333050338ddfe085b8cc869ca98b206c08243a" ..
+        "26f5487789e8f660afe6c99ef9e0c52b92e7393024a80459cf91f476f9ffdbda" ..
+        "7001c22e159b402631f277ca96f2defdf1078282314e763699a31c5363165421" ..
+        "cce14d",
+    [1025] =
+        "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" ..
+        "f4c4a22b4b399155358a994e52bf255de60035742ec71bd08ac275a1b51cc6bf" ..
+        "e332b0ef84b409108cda080e6269ed4b3e2c3f7d722aa4cdc98d16deb554e562" ..
+        "7be8f955c98e1d5f9565a9194cad0c4285f93700062d9595adb992ae68ff1280" ..
+        "0ab67a",
+    [102400] =
+        "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" ..
+        "e01c59dab908c04c3342b816941a26d69c2605ebee5ec5291cc55e15b76146e6" ..
+        "745f0601156c3596cb75065a9c57f35585a52e1ac70f69131c23d611ce11ee4a" ..
+        "b1ec2c009012d236648e77be9295dd0426f29b764d65de58eb7d01dd42248204" ..
+        "f45f8e",
+}
+
+function test_trivial_obj ()
+    local obj = Filter:new("blake3")
+    is(expected[0], bytes_to_hex(obj:result()))
+end
+
+function test_vectors ()
+    for len, hash in pairs(expected) do
+        local got = Filter.blake3(test_input(len))
+        is(32, got:len())
+        is(hash, bytes_to_hex(got), "BLAKE3 of " .. len .. " bytes")
+    end
+end
+
+function test_input_in_pieces ()
+    -- Pieces of these sizes end at all sorts of places in the blocks and
+    -- chunks, so that sometimes whole chunks are done together and
+    -- sometimes a block at a time.
+    for _, len in ipairs({ 1024, 1025, 3073, 8193, 31744 }) do
+        local input = test_input(len)
+        for _, size in ipairs({ 1, 63, 64, 65, 1000, 1024, 4097 }) do
+            local obj = Filter:new("blake3")
+            for i = 1, len, size do obj:add(input:sub(i, i + size - 1)) end
+            is(expected[len], bytes_to_hex(obj:result()),
+               len .. " bytes in pieces of " .. size)
+        end
+    end
+end
+
+function test_length_option ()
+    for len, hash in pairs(expected_long) do
+        local input = test_input(len)
+        is(hash, bytes_to_hex(Filter.blake3(input, { length = 131 })))
+        local obj = Filter:new("blake3", nil, { length = 131 })
+        obj:add(input)
+        is(hash, bytes_to_hex(obj:result()))
+
+        -- Shorter output is the start of the longer output.
+        is(hash:sub(1, 2), bytes_to_hex(Filter.blake3(input, { length = 1 })))
+    end
+
+    -- More output than fits in the output buffer all at once.
+    local got = Filter.blake3("", { length = 100000 })
+    is(100000, got:len())
+    is(expected_long[0], bytes_to_hex(got:sub(1, 131)))
+end
+
+function test_threads ()
+    -- Big enough to be split between several threads.
+    local input = test_input(102400):rep(20) .. "x"
+    local hash =
+        "c78d24c91eed9edb70750e545b86df91dc977af5970816df566e8c039ac46aa2"
+    for _, threads in ipairs({ 1, 2, 3, 4, 64 }) do
+        is(hash, bytes_to_hex(Filter.blake3(input, { threads = threads })))
+        local obj = Filter:new("blake3", nil, { threads = threads })
+        obj:add(input:sub(1, 1025))
+        obj:add(input:sub(1026))
+        is(hash, bytes_to_hex(obj:result()))
+    end
+end
+
+function test_clone_part_way ()
+    local input = test_input(8193)
+    local obj = Filter:new("blake3")
+    obj:add(input:sub(1, 3000))
+    local copy = obj:clone()
+    obj:add(input:sub(3001))
+    copy:add(input:sub(3001))
+    is(expected[8193], bytes_to_hex(obj:result()))
+    is(expected[8193], bytes_to_hex(copy:result()))
+end
+
+function test_bad_options ()
+    assert_error("length not a number", function ()
+        Filter.blake3("foo", { length = "long" })
+    end)
+    assert_error("length too small", function ()
+        Filter.blake3("foo", { length = 0 })
+    end)
+    assert_error("threads not a number", function ()
+        Filter:new("blake3", nil, { threads = "lots" })
+    end)
+    assert_error("too many threads", function ()
+        Filter:new("blake3", nil, { threads = 1000 })
+    end)
+    assert_error("length NaN", function ()
+        Filter:new("blake3", nil, { length = 0/0 })
+    end)
+    assert_error("threads NaN", function ()
+        Filter:new("blake3", nil, { threads = 0/0 })
+    end)
+end
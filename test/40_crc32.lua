@@ -0,0 +1,89 @@
+local _ENV = TEST_CASE "test.crc32"
+
+-- Each input maps to its CRC-32 and then its CRC-32C.
+local misc_mapping = {
+    [""] = { "00000000", "00000000" },
+    -- The usual check values for the two CRCs
+    ["123456789"] = { "cbf43926", "e3069283" },
+    ["The quick brown fox jumps over the lazy dog"]
+        = { "414fa339", "22620404" },
+    -- Test data from RFC 3720, appendix B.4
+    [("\0"):rep(32)] = { "190a55ad", "8a9136aa" },
+    [("\255"):rep(32)] = { "ff6cab0b", "62a8ab43" },
+    [("a"):rep(1000000)] = { "dc25bfbc", "436fe240" },
+}
+
+-- Data calculated with Python's zlib.crc32() and a bit at a time version of
+-- CRC-32C, for the first so many bytes of some data which progresses in a
+-- simple way.  The lengths are chosen to be either side of the sizes which
+-- the different implementations work in.
+local progressive_expected = {
+    [1] = { "4c667a2e", "86b737ba" },
+    [2] = { "f497b95b", "372ac6df" },
+    [3] = { "78fc346b", "da98f9b5" },
+    [7] = { "c15d15bf", "ac728e60" },
+    [8] = { "5110375f", "1b855fd4" },
+    [9] = { "72591dc2", "aa29ee57" },
+    [15] = { "fda03be6", "8a657b29" },
+    [16] = { "d62469a3", "6b3ef05a" },
+    [17] = { "536add29", "cd83afac" },
+    [63] = { "8e13c335", "0d331b83" },
+    [64] = { "4f5e8be1", "71c3da0f" },
+    [65] = { "004034fb", "1b58ee80" },
+    [79] = { "15e17b86", "7d4206d0" },
+    [80] = { "eda2082b", "a16e7e22" },
+    [127] = { "b34a14ad", "26e95e9c" },
+    [128] = { "2ad30bf0", "fc28ddc5" },
+    [129] = { "1c49d819", "f2c116c7" },
+    [200] = { "7d132045", "a4f13e9a" },
+    [1000] = { "24964f5d", "1509a940" },
+    [5000] = { "ece8b781", "317f1b45" },
+}
+
+local function progressive_input (len)
+    local bytes, byte = {}, 7
+    for i = 1, len do
+        bytes[i] = string.char(byte)
+        byte = (byte + 23) % 256
+    end
+    return table.concat(bytes)
+end
+
+function test_trivial_obj ()
+    for _, name in ipairs({ "crc32", "crc32c" }) do
+        local obj = Filter:new(name)
+        is("00000000", bytes_to_hex(obj:result()))
+    end
+end
+
+function test_misc ()
+    for input, expected in pairs(misc_mapping) do
+        local input_msg = input:len() < 80 and input
+                                            or input:sub(1, 80) .. "..."
+        is(expected[1], bytes_to_hex(Filter.crc32(input)),
+           "CRC-32 of " .. string.format("%q", input_msg))
+        is(expected[2], bytes_to_hex(Filter.crc32c(input)),
+           "CRC-32C of " .. string.format("%q", input_msg))
+    end
+end
+
+function test_progressive ()
+    for len, expected in pairs(progressive_expected) do
+        local input = progressive_input(len)
+        local got = Filter.crc32(input)
+        is(4, got:len())
+        is(expected[1], bytes_to_hex(got), "CRC-32 of " .. len .. " bytes")
+        got = Filter.crc32c(input)
+        is(4, got:len())
+        is(expected[2], bytes_to_hex(got), "CRC-32C of " .. len .. " bytes")
+    end
+end
+
+function test_odd_sized_pieces ()
+    local input = progressive_input(5000)
+    for _, name in ipairs({ "crc32", "crc32c" }) do
+        local obj = Filter:new(name)
+        for i = 1, input:len(), 77 do obj:add(input:sub(i, i + 76)) end
+        is(bytes_to_hex(Filter[name](input)), bytes_to_hex(obj:result()))
+    end
+end
@@ -309,3 +309,71 @@ function test_gradual_size_increase ()
            "MD5 of " .. string.format("%q", input) .. ", with i=" .. i)
     end
 end
+
+function test_md5_many ()
+    is(0, #Filter.md5_many({}))
+
+    -- Messages of all different lengths, in no particular order, so that
+    -- the lanes finish at different times.
+    local inputs, expected = {}, {}
+    local input, byte = "", 7
+    for i = 1, #progressive_md5_expected do
+        input = input .. string.char(byte)
+        byte = (byte + 23) % 256
+        local pos = (i * 37) % (#inputs + 1) + 1
+        table.insert(inputs, pos, input)
+        table.insert(expected, pos, progressive_md5_expected[i])
+    end
+    for input, digest in pairs(misc_mapping) do
+        inputs[#inputs + 1] = input
+        expected[#expected + 1] = digest
+    end
+
+    local got = Filter.md5_many(inputs)
+    is(#inputs, #got)
+    for i, digest in ipairs(got) do
+        is(16, digest:len())
+        is(expected[i], bytes_to_hex(digest), "MD5 of input " .. i)
+        is(Filter.md5(inputs[i]), digest)
+    end
+
+    -- Fewer messages than there are lanes.
+    got = Filter.md5_many({ "abc", "" })
+    is(2, #got)
+    is(Filter.md5("abc"), got[1])
+    is(Filter.md5(""), got[2])
+end
+
+function test_md5_many_bad ()
+    assert_error("not a table", function () Filter.md5_many("abc") end)
+    assert_error("not a string",
+                 function () Filter.md5_many({ "a", 23 }) end)
+    assert_error("not a string",
+                 function () Filter.md5_many({ "a", {} }) end)
+end
+
+function test_add_big_chunks ()
+    -- Big chunks get hashed in place, with the partial block at the end of
+    -- each one held back for the next.
+    local input = ""
+    for i = 1, 5000 do input = input .. string.char(i % 251) end
+    input = input:rep(20)
+    local obj = Filter:new("md5")
+    local pos, size = 1, 1
+    while pos <= input:len() do
+        obj:add(input:sub(pos, pos + size - 1))
+        pos = pos + size
+        size = size * 3 + 1
+    end
+    is(Filter.md5(input), obj:result())
+end
+
+function test_add_more_than_2_to_the_32_bits ()
+    -- All of this goes to the algorithm in one call, so its length in bits
+    -- is too big for 32 bits.
+    local obj = Filter:new("md5")
+    obj:add(("a"):rep(512 * 1024 * 1024))
+    is("31e4d9c6d74cd592b78f77f72965d6ab", bytes_to_hex(obj:result()))
+    obj = nil
+    collectgarbage()
+end
@@ -309,3 +309,55 @@ function test_gradual_size_increase ()
            "SHA1 of " .. string.format("%q", input))
     end
 end
+
+function test_sha1_many ()
+    is(0, #Filter.sha1_many({}))
+
+    -- Messages of all different lengths, in no particular order, so that
+    -- the lanes finish at different times.
+    local inputs, expected = {}, {}
+    local input, byte = "", 7
+    for i = 1, #progressive_sha1_expected do
+        input = input .. string.char(byte)
+        byte = (byte + 23) % 256
+        local pos = (i * 37) % (#inputs + 1) + 1
+        table.insert(inputs, pos, input)
+        table.insert(expected, pos, progressive_sha1_expected[i])
+    end
+    for input, digest in pairs(misc_mapping) do
+        inputs[#inputs + 1] = input
+        expected[#expected + 1] = digest
+    end
+
+    local got = Filter.sha1_many(inputs)
+    is(#inputs, #got)
+    for i, digest in ipairs(got) do
+        is(20, digest:len())
+        is(expected[i], bytes_to_hex(digest), "SHA1 of input " .. i)
+        is(Filter.sha1(inputs[i]), digest)
+    end
+
+    -- Fewer messages than there are lanes.
+    got = Filter.sha1_many({ "abc", "" })
+    is(2, #got)
+    is(Filter.sha1("abc"), got[1])
+    is(Filter.sha1(""), got[2])
+end
+
+function test_sha1_many_bad ()
+    assert_error("not a table", function () Filter.sha1_many("abc") end)
+    assert_error("not a string",
+                 function () Filter.sha1_many({ "a", 23 }) end)
+    assert_error("not a string",
+                 function () Filter.sha1_many({ "a", {} }) end)
+end
+
+function test_add_more_than_2_to_the_33_bits ()
+    -- One call to the algorithm with more bits than a single carry into
+    -- the high word of the length can account for.
+    local obj = Filter:new("sha1")
+    obj:add(("a"):rep(1024 * 1024 * 1024))
+    is("ecebf8a78d57368378471ce3d7046702ed865e92", bytes_to_hex(obj:result()))
+    obj = nil
+    collectgarbage()
+end
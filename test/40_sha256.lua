@@ -0,0 +1,327 @@
+local _ENV = TEST_CASE "test.sha256"
+
+local misc_mapping = {
+    [""] = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+    -- Test data from FIPS 180-2, appendix B
+    ["abc"]
+        = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    ["abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"]
+        = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    [("a"):rep(1000000)]
+        = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    [("0123456701234567012345670123456701234567012345670123456701234567"):rep(10)]
+        = "594847328451bdfa85056225462cc1d867d877fb388df0ce35f25ab5562bfbb5",
+}
+
+-- Data calculated with a bit of Perl code (in the file
+-- 'test/data/sha256-gen.pl') where each entry in the array is for a chunk of
+-- data of as many bytes as its index, and the bytes all progress in a
+-- simple way.
+local progressive_sha256_expected = {
+    "ca358758f6d27e6cf45272937977a748fd88391db679ceda7dc7bf1f005ee879",
+    "7bbf3d30ce40a6175e078d7e0c21494637bdf3660b8c5068761d1b54e4a15416",
+    "3df81aaee5ccf0d3d764a5ce91d68bddea291bd68e036243a3879b642a62a844",
+    "4a882a727a2e289be3d84956abc3abba2b53595a14a674948664ad45879d38bd",
+    "6cfaa7ecc582dc5222f926a642675a0de93c10510f9ea3e8c60c931d78b3314a",
+    "86f28a494b7466ac29aaa7108ef8672d268972a6d2e97c2e44cb872aa757c52f",
+    "3123301124b22131d96c8e44a506b2cf42a1b4b91b2275a3589399058ace537a",
+    "dce835a1a54a0e3d0f3fdd58e78f8d6c78bd3aeb5dcb93abb5f9657a18cdaee7",
+    "86049c463e7e98f3601e171ca3a3982132056165f640560f7ffa3cb33755f184",
+    "2c34917e60084eb249266da1a93df914cec12b885feacf280f345dc26653b574",
+    "b05a9cc8ec0863b2807401fe508fbc57dfca2c04f8f543304c1f3048fea33483",
+    "c813d5069f6b16075c2b878a91131d15b82b9971d63d4a9002666fa462f8874a",
+    "1782b9edeceef56591bef84260b8a1124f9fbe7f409df7c138d2ddf07fb42fea",
+    "df9233fcf4de6ecab763faa63e2be134616a28946e66126e9964aa89fc37b40c",
+    "4ffc4b3f33312f6b0374862b4475df662600afaa1881b8797d9888e94401f979",
+    "4990618dfe4cc1fe347855880d7a8cbea77c107363a1f669fe06051735dba550",
+    "c7b9e3ca2014cc940bf4c6eed1a9a23f8dd61b52ac2e06770c95de91e961f0af",
+    "6fbd37b47c0513e813821ec285c6ef3b572ce0e027699099f8c91c69f2f28f6d",
+    "5ca1a7a94b1746497de64a7beab52d1f9902d79983c686e9c707b3f35e3530ca",
+    "26a44b9e3c1db1b9cd3485652b0aba418532c457df317477920064f5234e6ef2",
+    "ebe46dd9eec7efa40cfeed235b291076a290e1134fa3fb48e4936287c161033d",
+    "c96a46d79f2483316a0ba8605493041c8fdf873569c904acef7c1426fe602564",
+    "d31018409e67c57dab4b6338dfe37561bed6599a70246a3150bcfb8512a79395",
+    "2966c2ef7e6acdf903e9b8ccc319945868c65b0f5b40d71686cf2ed1cd2e20c1",
+    "5b3b4089ae6e147d9f940b348aa9e7b7462361c52e6bfbe21e64c23fa6826990",
+    "8e71d671a0bd49602eafad90586bd003d19cb6cbc3afd72843240024fa8aa12b",
+    "a6ba548f8662bb21f1ed9a2712cc9cc8ac43ef096d77e55362503ff377b5e46b",
+    "0fd4501bd2ae2cf684596db3d0fcd4067c21e2b33e8609fdab7ab4055cb1da4a",
+    "0d387d17cac4364b9bb58cbcbdabbc31010a15e55ae24ffe6cf1c1656db0bfd1",
+    "f5874e2dbbb04eb6112474739eedc126551b45d86668e5707baf36592c8471e2",
+    "04f2ab6eab84011948aa2d6fcd984c62477d99c5fc12f5ee0ee9b27802b9ebdd",
+    "5c6a3f0b1919ec1cad513d867d09d956ab71dc24fa294dd56ddeb3c03a3677b3",
+    "59890003eb67ca6c282f25feb913aca72eb4ca768a39683e4d73b9329e2dc05a",
+    "2ed5a0c8eed237f01c7b50dac6f3750fbb01f2541dd8075bcc89c7e7a069ac34",
+    "00d00dd6d0f5d0250661ac956d6ecdf594dc8ffb094caaa5e58559359d5407e6",
+    "b988ceaa54b9a302ff6eb12aecbb2ac670b2f6e625662f0e5afcd0924f3dbbc4",
+    "a02ad68f6e82d6b3f550591aa566508dfe4a61bb2a537381a4b5875685e221ea",
+    "26e429d39f277a53157a2fcb2057846787b15d29e402f59c713943dccd7f4bbe",
+    "6a964688de8cbe636eb4b2d5f0b7921d6a6a2c6754525a2045a8170d460348cf",
+    "1394429bb982165eaba66d8d7fecf5fafbdb3a3eb02d03e6e624bc61c007a1ff",
+    "703f15ee38d1c453a3ec14df29a6acf8982d0dd78321108f58df2a6ae4ad2c97",
+    "422815729e14a69477a033cc733b443fb85b5258977006dc33baa52ab42d7198",
+    "d0307bfde579d6f57458d90395c8f6eb591ca46432c40389a786cbc6f83a6044",
+    "a99ab6c085a267acd8f913b11102bc2e07b0f54ae95f6374a4de098d193c7601",
+    "43591b71766a9dc4d7515b5d58b1572a0f402621a2bf5b7cc82049c8290389b0",
+    "1fcab8c99baf531ff6b2b9d34106bc20a0e0e99b465989fa6ed78401f179b6fd",
+    "56f0a90f935dc76061c38588a73a688675e214975aff3810c3cdc6c3233f05d5",
+    "59b4f04d754d2567f263125f7eb74a55343c824be03aef77f6bc92081c800f25",
+    "b16f583ee6700c3aeb59844a733baba9d637cc3020ea76cff7355cbeadb65496",
+    "7becf98109b1a5f29d40d34de805ed354829f6e674272644d0316cadef318ad9",
+    "d19712b1dce1ea153818bd7340e5141982bb47efed57d622c7272b8168edb75c",
+    "4ef259bc45be1ddc0b6e9163c20e22a75bce41dcd1f8d53a64981a956fd6cf0a",
+    "e72e1535894e67b49ac868530d119e5a2fa3c1f620097458529e2ed77c64bf2d",
+    "9ed397191e968f594eafa2e7eb4ae0cb81624f44493f4c41814d609c20126073",
+    "95df01ea3174d0c89c0f40a2ff71cea6edbd6ee72b47a9f839449eb27dc8cf4a",
+    "1bdf6c040d8a6a2ea727e74879845ed30f3841d2c64db21ed5c6b606dfae8a13",
+    "d46a18a7e7df4bd7a8e9c5ba6ebeb5751044249dfa621fc1b978cd6efd4cad8b",
+    "8e727d5dadaba918e775fc246161ab4abeff06446afaf9a791490759d6203303",
+    "90a687bdc925273a2f27421b4513420213bb29d85313b85933476f9a8a64b9b9",
+    "807751d3bd2e844d422bdfd766e46ea586fb13a677e7205c82755408dbd5f880",
+    "f6e6e0e10b153640b0cb988d5786ae248faf004e856a8f68548f28d0d6726fb4",
+    "9aeb0a9d802674b1923bcb92ead3ad459f943f2fe364b19ebd6b74d1020c6576",
+    "500d72a8bdf1c44c001fda951d50921c1e04b86bb8b14bf628455817060903ae",
+    "62896950e1dec060b0a34d4e7a7256a11bd600d7294f1b723ac9720a5aaa5dc1",
+    "e92088f2af5342353777db28415b4c97254f39a8e7cc8b4273e20c4087ec2c16",
+    "e92949174d9ea72ea27df08563cc4a4cc02f325fcaabdfc766d4993adc74bab2",
+    "646e47c7f308c200a110d9f82dc11d2e9295cebd5435a3d70d80d4b44171490b",
+    "fa5d051e77bc4cb862a749c3d09fe9caeb20a919967a5c1bfb7772b50b612a40",
+    "7557315c8bc111a1c7927c831f926b33099d67cbc55e6fcf220398394e000afc",
+    "4dcff86661f4ad5225d62577a381adab9c4592d1d8366ec8021c733c000afb19",
+    "fd27c7f7147dfe38471f73204cc2fb13c438448f3f178a89f1aedd62695ad5c7",
+    "fcd942e000af2fc8bf00f859b21129edeba2fc9636ab44d5c3cd08b011e24792",
+    "2a376aeabaff6edd9592a20c4edfd0d16360acc0ab0ad4e0a3cddf4c0516b536",
+    "b38946c8429c4738c7ba5a33701f39ee9b1bfb5b76daaa58c80fb0291c1e57a7",
+    "336bbeb3798fc5fa0b3ca3f3f2d12a08cd6e3f63d0ac4e843eedb47a4e9a15b0",
+    "9d63ff17cbcbf9a27dca6e5b0f783bb257153d0c05a9d79322d9c8e9b62a91d2",
+    "0a11361a5855ad2332f5028341b03b869621b85ed6df5b847329409138db6b36",
+    "860e262ce0e1c7bfeef43ad709b90ee2a6abd1d81cfa43d224a5ea487165d0f0",
+    "70e6682efde45e0abe04571c3d3c1cbcae8e645607cd697d0acfea2ff25f7765",
+    "3ca98aa5f2fef278b8480e0079582f126e16c5be273a71095f296e2e36d8dd56",
+    "55a2c1d8a1b4bba460a7cb409e8e658e00ec0f0bae2492cdbab83525f63d4e49",
+    "0d6b63b32fbf35e7fee2d06a64e095d0b517ed2d53d0a93ffddd6d83af6c7c43",
+    "0eca8fe1dc5f5881acb2abcd775c1cf703816b750986add0257e812b5e14cbdf",
+    "f9634a5ea349970dd7f06bc49592394628adcddd05391927035b4760c8ce9cfd",
+    "6d44ffe2f78c4749ea3fff807ee867062e388dd02163eee4d675f30aaef434dd",
+    "a7d277af9977a35f06b04a83b1a3e56560c8ba477d889e5725372b1fb6c2f887",
+    "2ac997d55c08a2f6492b286f76bce08f44a9b23d30d26e2c9c918ca4100873c5",
+    "aabd02ef08fdef06b8a70538cbe59526ffac188936209eb2217f6edbf1fa5682",
+    "bd06a254493de969192ac46ebf7dc0d77f5903eae8d26f781b308a668d0bbed7",
+    "bed97ed7799c7f464db23f941247b756d50e3fc3cb43487485f82ba0982f2bcf",
+    "b3fbf3a6cfc449d40a53e57062f2b6b0846819f5836a3656bf2e8d93d4041944",
+    "97de5b32b2af819ef1682d94ef1b66088d5827060e5409d7bd217b9c7868a5e1",
+    "67a6e79c428d3f82004f7e9a7373f892e83efcac6e87c151fe5e6667b9f020c8",
+    "34f5ea32830b517e67466c25477cde3df2d059af39417ee66850133f3d18a81e",
+    "2cb3c206c47c4e68ad8cba9de80b862bcfabbfefb7fd7f639bd30c4b18454182",
+    "59649da5e872560075d729ab8142dec6c5b404d4b760cbdad098ccb79f8bca0e",
+    "5cc5d6d6fcfe1a9166618b7ea3fc31d56bae007a8708d85d845a3f7953708fff",
+    "a214c266bbe0a47eaf543151e35f9ea38b5840dafdea660077ad8acfbc55f152",
+    "4d943c0d6fadeea56a40e12f0b9e9a2a5e8b5710c1466a482f0e6111bdbbb948",
+    "9e6b16a699679466d63423ee3dae5aff26f867716884a352e0b95a92f039bd7b",
+    "c798b5f6890cf5deb76cd6de618bc35032dfee3f79961ef2e9b67d91d9198b85",
+    "8927c1bd4639813ee6fc363a0daa2c493e9c6c9c789a9933dd31b059e84bb30a",
+    "d6539d985d12722308cd23670609ccbd9eaeafaadd82874dcba415a4d3ad3061",
+    "8bcd9983c32c87d5142bef428c24ef706c47deb3dbde6abadbf3faee2667628f",
+    "ea2100a270d02ad09fd4430b11b60e17c195bb7467d3e0aa46a8d8751e605880",
+    "6819c2727da7e9f73655f4afe93923dc12e8b1e33b4877fd8fdccba3f83c086d",
+    "021202395388e4cd12f9216aa9eba494d93ebd5c3da231f1262b45bf32b1946d",
+    "865332ecef5575c8f4d06c85eb99eb69b9090cb54306b9c5213211fd369fc6d9",
+    "3b4d9fa34b61064c4508469262e8f8a674558af912b2d3f167be21281e878d03",
+    "7e2ad549ba8d5cb2a963adc6110118f0f462d20eb73842610193c7e08e2698a1",
+    "1ffb9bcb47368d82951b545d8db4c235841ed060a381b5dd962f889d6047b147",
+    "a0540f7ce1afb8eb469a286973b6e9242855fcc85d592a652bfc4d93d3565d89",
+    "17f7f51102b4af2e13f13046ba70a1964d0783a79491004f42736c20397c1321",
+    "13bb9de72edabca29c5f778aae47c9891c4ed56345ec2019a9a20f989a6380ac",
+    "825d4a4b9a6a1fec454d5cca810a54db653584bd080bdadc3073409f9ec1c359",
+    "6062fbb2b347c5fb870282306904c00faeb92523440b5a400d28e04a02a2f0e4",
+    "ba35654b0f79e6b32a2c4c1f5c56ea5e694d317bea27a0ee8a63199ed9285e9d",
+    "fa735695f4dbef030f8fb1cfb8d07fb3df90abf88cb5ecc910e8dd59d0a907d7",
+    "a6f6ccecc2c85f648c721de0dfd0f8c397ad11e0c61cc35d7f39ec52fb51df3b",
+    "b37f9c639a2df34678b1abfd6c0dbc08c5e1860351852c18837963d59ade7e38",
+    "e28dbc52642d0e237fde8fcaa38c1e1bc2e12752c4a4d289f99287eb57909119",
+    "46bfadd573e85b765120bef70e110ff6849fcf6ec8c1c829810b445fd5022112",
+    "2668b5d636ee780f2c9bf67d683aa07374bedd8b704ba463e7c7e59242067f4e",
+    "f7e2eb910ffecda1197601d0db82b3cdc79c258985d4f9d031dc52c1f31bf42e",
+    "5bca7665c574ecf6344168823f3b50fd29fb2f86e4a7252071ef3437b5a8d126",
+    "cac62629ca9b21b943e78ed3af2e64cabf6c6d0a65ab2c91402d7517c5a71669",
+    "d5b84b7e97d43f8181ae7d580b7e944fb91a31d58db04f0fa745fc06342f012d",
+    "2fd7d819117256a143ec8fbb44bda680e6a17db4ebfbba5929722180c8f192e5",
+    "ce97299ea4658c7bd0d9e8cfe1b14d3b1901ea1a1eb045dc89dfbbd125660145",
+    "58dc30fb1346263441d953ab38d1c410d3cfb394c52a207080889d1e43683eec",
+    "480903e7a946c2cbe0582f2fe0e43f92eacbd5af038035a396c251b588c1ee69",
+    "64718de8183c98edd0303325824878ff4c46dcc8f99144f6128bafb5fdc99e78",
+    "9a7395a97f77820209271d381b1de836a0f9b5ea36414ee0b1c71752edb68ffc",
+    "e0f0b5735a5ae43ee78dc2bee3dcd97fc3abc033942f40cbc2162b59aa12ec9c",
+    "b951810b6880fa29dce335a218e2e12bdf1fdd60a55be2a46dfa08497a4077fa",
+    "d49504e7c2419fa7470ed4aff3dd5b77820ee8d6ab52b15cfb2148363be7726e",
+    "a95d60c535c164d4012a001c5b7cf3d28455eea95689702c367c46c7754b5d26",
+    "b971148dd2185a1524527962d134d524c2dfead3a0ad41d972feb0f65fee53de",
+    "b0cd647c15ab802f1f5c6e9f65ace20819272b1c54dff9edee324d6dc4dcfaa3",
+    "72412ec913d67744c8e9f5f9a4cee1c00d22aec9c51758cb981dc4008d3830a7",
+    "3c243eab1d5cf862bdb7d6a0a9fd7e59d533d99e08c74cd13e2dc570c0873e71",
+    "b3d5d16bde29a57f7f0aab971f3b528759753af75f7f3f1b270ce2115dfc463e",
+    "26b17cf8732ba87ae969ba7878a509406be1bbcbd2b9d9221e0971d053631890",
+    "6cf82d73a0ea8f3b9ebfe25023ba51f16d83d08fae61a2ec6c249bd6042eb0a1",
+    "029900035a3765dc0aa74b4a456578115c57a26c7e7d7e315d6b439dab612ee2",
+    "03d3a8228f97420bee3dfc90539356ddfbb323568e8871af910920228ce2ed9a",
+    "58e68782b4f82399ae24ed5b7b4cc64623145055267c4173cebfef0dc7444474",
+    "ccbf3939046224e879f848f610006ae1a51b45d7e45145fd8bb79606bc4ff8ce",
+    "e0a52720950cd7726296af29987b8253c62e292b6fed46091e6f51cdbe8ff754",
+    "6bf7e01dc719c8a1981f7d1ddb8f1b3c0905cbbc9dbcd409b0aeefd745fe173b",
+    "a73e838f696496ab0f38642003e335d2224cf4ec52d8fe32dac20c5f9f7a8a67",
+    "fa3ff2698cbb4836c1fe05fe2ca70c22362155c9e053709bc633f2840dda210e",
+    "d9b855a4f637f8382d501841a9b1a2e5a0562032013b37b6f6a442fae5353fcf",
+    "1ba1a803bcd585d97a3b3fae526a679c770bea133ac34ca3f6e4a662f2127d6d",
+    "da1e16c31e4015e336852978e671310ac39ff57dde0be48f68110683004a80bf",
+    "e7864d2573114f1e5a6787287b15d8d9823395215eaa6a9f9ca3704b12147cb9",
+    "f815abe6e618abe176df4080f87473db42ab0bc3cb14c05b68592375798cad46",
+    "45cdaa91a5a0171c8bedd4969aa68e6fbafbf0e6f385ef6db971cd5db7682845",
+    "53365b6fd48aa8995c349948e75b646a7ac06dcfb333a261ba9c44f02b4a784d",
+    "34ebf8a8df5f3d29fe459ae25eec506d7575d90912ea64f32db9e95c4c79dba4",
+    "a28bbae1ce938058faa978361a945ab26cce7a9f026652e51ac12a7437397fc5",
+    "a9733af2ad7375ad76d8d56274e20ebe17a41f9a57251fca9e67ca137545464e",
+    "ec17a9a1fa9d96f52b4ecd2005f49e2769b1ab82bcda0447ed115e78ac8ad946",
+    "cf84309d708583be62034a087427e7cad462dd63a0f184bfedd3be9051bf3b01",
+    "05c214a8ac512cb3901539c0d1499dc4ea6b329b167d89f47daac7e6ac9f98c2",
+    "0c6ed5c616e3a9c507a54df6fb77cf07d742dffb9d9ca1b0412ce800b90c2013",
+    "34825a5d2edc8b9f8e19896d8bfd50ee085d4c766b32ebc0b1c04af8a8faa84a",
+    "105600acfb409b331ff556adc8edbbbe376a42262c2ab2c2ca267c5b47827f74",
+    "23e021aae9a8ace2cf1e1481a201fbd9410c0db453ffe18d96a70dc2faa6e995",
+    "90a4714df971f8a01273385d1cacdde40636cb36d216c823766a3ee9666307e0",
+    "e9dcad4a0c73cfbabfa4f802043846acc28fcaac5f98df6a6ad821486c9d02ab",
+    "2d55c99410f4970ee5486d8b29c6ce870793fcbb798daa56357d53a7f51e7398",
+    "13bf6f7b4c4c6e6a45a340b3015dafa62ced1eac510c118c9374fdfaa4aca0a1",
+    "439ccda0a9efc927944441d9216164d60947a9bec9fc82cb4322ad58ed657226",
+    "9bd065a269a8fa61611c5aff9d3daf7ca62bd4be36a1721e7ef1c4efc7286844",
+    "baa154e501784cf2325c87e706e34c4fd00369416d48868fd22bd64af2d1e739",
+    "2780328192061f71cc877396655213fb3008441c1e45b600da7b5a7be46223cd",
+    "0b65748282dec14ef5b918d305f190a97795ce0c5ff9afb9fcc687279503de89",
+    "48c0fff0f24b643b36986a7845e17ba54b118347aa920355b0c6e63fc0fa64c3",
+    "74541c06d220e64902faf61956e7420287466da5d515fb123c5e52f8fa1f40d5",
+    "20dad3c73ce84c58e702be47f98167ca15b4e7e7a966f1476cba26fc6ff1472c",
+    "67f62f94958438bc28978cd238283636fe43359d4b2fdf07dd2be226a97e3487",
+    "48f14098a0e122f4f8e46cf0946ff56bbeb503bdc82732d6bd52cd1ebfd77cd6",
+    "d2af69342254f651c2817e470c8cd01c1f98fc7afba796c88460a341081b2d38",
+    "80ee16943ab23527e3d11b01bab8bd9b140e9d2e4da327f8c8543784b36e7bc4",
+    "cbb79f064df9796bc52e5e533409b610089c2e3974da85eacb982919e3fc008d",
+    "beff090d6bad770594cc4a54696b2c78cb888bc0e7bcc8ad00dde9b2b674a6f3",
+    "ad71bdd679a6e79a412821e5d93dc9ff7ca87948ea78ea77764d958b856b01d8",
+    "5618e7ba2653cd56793318a86b39b76da34b803969230dd99eb1258ea05479f2",
+    "ee18ab565877527822475a5c685a06e8ebb26a6e59714857052cbb4c3f3b8697",
+    "e23c37cc86889847f68bd9f121922ab808928c0d100ce6389fb1befd6cec4598",
+    "1460fb2ae573d1dc09e75e74a3ad04499969942f349a4e11d9be5be51b581f33",
+    "18165ce9e4902f5adfb28c8cf9042cc6d51ccf390b932407291efb48f159b2bc",
+    "a432273b689b8a372c794a4ebc76b613967381618d1fb03e249be50b3e395e9d",
+    "eb2e297dc38c759fad91c30ab37c0c1ac87d3480c0a50335442e7bbffb7767b8",
+    "edb44ce2f88ec1c0af86988e2b1f4092499e3f3019f511cc8d077cdd2ae8906b",
+    "38e4d203626c0aba79f848b498725ed65895f4bf1b682dadffe8cc23b2bebc01",
+    "8fca8dab37c1e232b7470e1696e2707d2f69c2f835c0dd044bd072ec60e91638",
+    "4318a4c06c20b6c940d4082347bf2983b4e1ef56aa7f01f3b4508812913b0b5d",
+    "736ab20c582ffeb738711aa095d0eb91d77531d1fd0939124a31ba74434a1d4a",
+    "e3860b99c6c2b8023862e1fd7356fce864036d046907ccbd46794de7cf09a1b1",
+    "3d2708d67fa59ca256fe5ab1ce13f6fc2a324d6ca3f48c493071e892451a81bb",
+    "e6905bcd9f02fe4f16422e0c2de9ed202e2fb91a41db2663c53974b4656b7b90",
+    "e80b311e488c7dfaaafdd58dd7486a26fdd1f3d6bfd78d4b33f0d0ac19fee650",
+    "1316b4ca174629790e6ed049e57cf1bb960d4e0d92c125957f991398c22b08b2",
+    "2d38f96561a12bf67a7f640477fa7d9d9d5c8e36d54e8f55bc8f3cf13ad6a63f",
+    "6d5265b9eabd8bf69dbe5c183a63f21981fc82a9c3aa04b0eb856315434d5f5e",
+    "4b5bebf1a13e7507a76ae326fdc5b72352927d54452bf921bd059d00b164cac5",
+    "89daa12e5821aea2a01a7216ecd5bbdcc6dda3ae985121e3ed5775ebbea2d961",
+    "05dfcf26927bb8a9f657d58f4563bac16a485ddc353abcf62fde8838e8772074",
+    "d20714401de182d5f72831f2560acc2bb82bcfee7ab0a9f522a0f6249df35e6f",
+    "8aed04e92118e7a4c2796c7b901a73b9928c9b64644bb6e7454f39ec577f93a5",
+    "96faf872f29858f78d9685326d58e13239bed7745144f83ffa8fa842bb599822",
+    "eaec2980a7b86e041f849444d41d54f53fc48b32cf824d92ec3722bf224c99d4",
+    "5127a2e71a027b83a612d98e985d20b12c88f9205010211cbd5360477d9851af",
+    "370fcaef02c897e7792098a4b2e12d172bf5796dcb7bd148a80956faf925fa17",
+    "8dcf7a3eb08b18f265498f543328dcc152f62640e094309e5fdf068e33124087",
+    "ed938d003acdafb334ca90a49cc88709113f82ccef4ba9b194ea0c89934bf536",
+    "032a7f99e693beff00c805d28fef66cdfe2bf36175f2bb30eb9733ac5238c44c",
+    "df084352f7634a0bf6ffebb6048fc624665adc2788d69e5f72ef76dccfc5a542",
+    "8eb17a99bf5cf1a21dd24d29aa7b7c55ec10e1737712084c25b1cdc66d2f3cfd",
+    "c6e0f3375bc0f16f1f7fcb8a8c16dfb8b3aa58c817b6536222116e41a8345d54",
+    "d2e739f5e6f249058e01aaa960ed09b7684ccaae6fddecb113675306286f7c6f",
+    "22e13baf89a4edc389db46838323061a65f809b757a1b9261d718299d70e5fb9",
+    "359d1f85d483d18bf63e2fc33c575a49012a17f39f3f03fca56b68e57ba3fb78",
+    "23ed40cd799e1954af567228cf81f29e6874870913e66c13c01a42790293c015",
+    "77caa0914e30552ab789dade665299bbcc336d476eed2e2d88017944ce9d722e",
+    "5af90afa190b884a045b9c6709eb9c9d849b957ca2aedcad51f4c388b52fa97f",
+    "4c66cb8c9367f5a0fab3aa483ecdb777da08e2150c08fc985242c266d09b8899",
+    "f0ba58f565394b0ef641b6049929cecaf90cfc5bc0124d62f39c80cb7eb4d1f1",
+    "6234ef46ca40a62b9470a71f0679ae1b31e37f8aafd03259f4d9253fe64f475e",
+    "0d3ed43a399b6ab3b72fcfcd8d4f4223da05c65a7647d918d718acbcc4080fec",
+    "a741cda281ac6c0af762d0bf7af28e6f51b1eb7330fcfddca938da4a0843b739",
+    "25bb26443588ca82e8c005fdd1570a75e63b11450670a839e4fd13ca45d36d38",
+    "e74f08f7c40f56d655abe8021fa3066d49ff441f05d896b97fd7f862cd86d713",
+    "b1e4aaa1ed2d925d47bd6658b63f5b7376bb8d03aa70155931f9cd47ac5e054b",
+    "606835c42ddd1f29135ff7d2ed040afb78f82dc26ed35a965ff163728c0a2e39",
+    "3e3c0e7ea67b42f999c54e410bf7793fd596d8bac53df35d70e8d5ae60e120a7",
+    "4f6139d384bbed4ea64b91953deb388e85b5f17a75474929defdc6a1bc470aa5",
+    "ac6cbec433e0882f442f3ab0dc9c0ff7fe0c9742909ea7d2cc77f28f9015ef0c",
+    "e19de9b67d3aebb2211eec99000836e83ad865d85da5729223d176b9c1932b0b",
+    "b03ba9e9aabf73a4c13c4c446777051d354d556dd327dcc51370515928c9c8e7",
+    "40b6943549bdda49d0b5522846b0b0b3c4c4e4b8a17d470766840c0179b48c07",
+    "b3d562a5d5bc2fafc5fbecf10f91bf5d186fd5813620a9f291572cfcf9981d58",
+    "6f821ef2fd38f5da6eaafa959e5b31f5ae69cd8d53e694d84b51ad1df89aea60",
+    "ff38971a600e2fe6f4f8a7d909e594e434cf823c0c9019ef96493700fda9491e",
+    "0068725174bbf857daeaf3a0efe2e7668828b7dd3cf9e4d56e966295cd988c5e",
+    "ed52d4c1601779a8553ead06f6e884bed1db76d8badfc3aee5775afa2e014b82",
+    "f3abe0406447ac07caf5d21d4c239dec06269d4a370a3a09f1ffe5dc75573f07",
+    "c1cab689604568d05c55dd3c73f06e022491c23aa2f4d6e8b8f15ef59ab6c025",
+    "33853a8e228915efdb356b6f3ed9aff72e17f85d16a02ed24bb2db0517d063fa",
+    "1528a33237badaf427fea4db81cec32ac272d6922287d8f316fd6eb102dad469",
+    "def9c425b7e34ba32aa45d44eaac48a42dc388683b14d6638644343c78c6d9e0",
+    "889ce95861b55df2ed5526da7a8cb42fcc28ed08e1e34a6ec2ece8290bf9b7ce",
+    "a117bc4e45bfad01bba59d897d5e8b6bb6565e76798223f29cb2d5b84d396744",
+    "00ac681e23439b370e330bf5e1a6927425089acbcf480d8014fd7f221b159c2c",
+}
+
+function test_trivial_obj ()
+    local empty = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+    local obj = Filter:new("sha256")
+    is(empty, bytes_to_hex(obj:result()))
+    obj = Filter:new("sha256")
+    obj:add("")
+    is(empty, bytes_to_hex(obj:result()))
+end
+
+function test_misc_sha256 ()
+    for input, expected in pairs(misc_mapping) do
+        local got = Filter.sha256(input)
+        is(32, got:len())
+        local input_msg = input:len() < 80 and input
+                                            or input:sub(1, 80) .. "..."
+        is(expected, bytes_to_hex(got),
+           "SHA-256 of " .. string.format("%q", input_msg))
+    end
+end
+
+function test_gradual_size_increase ()
+    local input = ""
+    local byte = 7
+
+    for i = 1, #progressive_sha256_expected do
+        local expected = progressive_sha256_expected[i]
+
+        input = input .. string.char(byte)
+        byte = (byte + 23) % 256
+        assert(input:len() == i)
+
+        local got = Filter.sha256(input)
+        is(32, got:len())
+        is(expected, bytes_to_hex(got),
+           "SHA-256 of " .. string.format("%q", input))
+    end
+end
+
+function test_odd_sized_pieces ()
+    -- Pieces which don't line up with the 64 byte blocks, so that some
+    -- calls have an odd number of whole blocks to do.
+    local input = read_file("test/data/random1.dat")
+    local obj = Filter:new("sha256")
+    for i = 1, input:len(), 200 do obj:add(input:sub(i, i + 199)) end
+    is("5b21e3680c52b06c705fdb9c8866141a816cc050b26a05566c6899a9f68c2987",
+       bytes_to_hex(obj:result()))
+    is(bytes_to_hex(Filter.sha256(input)),
+       "5b21e3680c52b06c705fdb9c8866141a816cc050b26a05566c6899a9f68c2987")
+end
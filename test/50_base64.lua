@@ -530,3 +530,72 @@ function test_bad_usage ()
     assert_error("max_line_length must not be negative",
                  function () Filter.base64_encode("foo", options) end)
 end
+
+-- Feeding the input one byte at a time means the encoder never has enough
+-- buffered to use its bulk (SIMD) code, so this checks that both give the
+-- same output.
+local function base64_encode_bytewise (input, options)
+    local obj = Filter:new("base64_encode", nil, options)
+    for i = 1, input:len() do obj:add(input:sub(i, i)) end
+    return obj:result()
+end
+
+function test_big_encode_matches_bytewise ()
+    local data = read_file("test/data/random1.dat"):rep(30)
+    local option_sets = {
+        {},
+        { include_padding = false },
+        { max_line_length = 76 },
+        { max_line_length = 64, line_ending = "\10" },
+        { max_line_length = 7, line_ending = " \9 " },
+        { max_line_length = 1 },
+    }
+    for _, options in ipairs(option_sets) do
+        for trim = 0, 2 do
+            local input = data:sub(1 + trim)
+            local expected = base64_encode_bytewise(input, options)
+            is(expected, Filter.base64_encode(input, options),
+               "big base64 input, minus " .. trim .. " bytes")
+            is(input, Filter.base64_decode(expected,
+                                           { allow_missing_padding = true }),
+               "big base64 input, minus " .. trim .. " bytes, round trip")
+        end
+    end
+end
+
+function test_big_decode ()
+    local data = read_file("test/data/random1.dat"):rep(30)
+    for trim = 0, 2 do
+        local input = data:sub(1 + trim)
+        local desc = "big base64 input, minus " .. trim .. " bytes"
+        is(input, Filter.base64_decode(Filter.base64_encode(input)), desc)
+        is(input, Filter.base64_decode(Filter.base64_encode(input,
+                                           { max_line_length = 76 })),
+           desc .. ", with line breaks")
+        is(input, Filter.base64_decode(Filter.base64_encode(input,
+                                           { max_line_length = 76 }),
+                                       { allow_invalid_characters = true }),
+           desc .. ", with line breaks, allowing invalid characters")
+    end
+end
+
+function test_big_decode_errors ()
+    local encoded = Filter.base64_encode(read_file("test/data/random1.dat")
+                                         :rep(30))
+    for _, pos in ipairs({ 0, 1, 15, 16, 17, 31, 32, 33, 1000, 5003 }) do
+        local before, after = encoded:sub(1, pos), encoded:sub(pos + 1)
+        assert_error("bad character at " .. pos .. " of big input",
+                     function ()
+                         Filter.base64_decode(before .. "*" .. after)
+                     end)
+        assert_error("padding at " .. pos .. " of big input",
+                     function ()
+                         Filter.base64_decode(before .. "==" .. after)
+                     end)
+        assert_error("whitespace not allowed at " .. pos .. " of big input",
+                     function ()
+                         Filter.base64_decode(before .. " " .. after,
+                                              { allow_whitespace = false })
+                     end)
+    end
+end
@@ -64,6 +64,24 @@ function test_hex_big ()
     is(expected, got, "uppercase hex of large amount of input")
 end
 
+function test_hex_oo_odd_chunks ()
+    local input = read_file("test/data/random1.dat"):rep(50)
+    local expected = bytes_to_hex(input)
+    local obj_lower = Filter:new("hex_lower")
+    local obj_upper = Filter:new("hex_upper")
+    local pos, chunk_size = 1, 1
+    while pos <= input:len() do
+        local chunk = input:sub(pos, pos + chunk_size - 1)
+        obj_lower:add(chunk)
+        obj_upper:add(chunk)
+        pos = pos + chunk_size
+        chunk_size = chunk_size * 3 % 1001
+    end
+    is(expected, obj_lower:result(), "lowercase hex added in odd sized chunks")
+    is(expected:upper(), obj_upper:result(),
+       "uppercase hex added in odd sized chunks")
+end
+
 function test_decode_hex ()
     -- Create some test input and expected binary data that matches.
     local input = " \t\n\r "
@@ -93,6 +111,24 @@ function test_decode_hex ()
     is("", Filter.hex_decode(" \n\t \r "))
 end
 
+function test_decode_hex_big ()
+    local data = read_file("test/data/random1.dat"):rep(50)
+    local hex = bytes_to_hex(data)
+    is(data, Filter.hex_decode(hex), "big run of hex digits")
+    is(data, Filter.hex_decode(hex:upper()), "big run of uppercase hex digits")
+    local spaced = hex:gsub("(" .. ("."):rep(63) .. ")", "%1\n")
+    is(data, Filter.hex_decode(spaced),
+       "big run of hex digits with whitespace at odd positions")
+
+    for _, pos in ipairs({ 0, 1, 31, 32, 33, 63, 64, 65, 1000, 5001 }) do
+        assert_error("bad character at " .. pos .. " of big input",
+                     function ()
+                         Filter.hex_decode(hex:sub(1, pos) .. "g" ..
+                                           hex:sub(pos + 1))
+                     end)
+    end
+end
+
 function test_decode_hex_bad ()
     assert_error("bad character instead of first digit",
                  function () Filter.hex_decode("01 *3 78") end)
@@ -100,4 +136,6 @@ function test_decode_hex_bad ()
                  function () Filter.hex_decode("01 2* 78") end)
     assert_error("odd number of digits",
                  function () Filter.hex_decode("01 23 7 ") end)
+    assert_error("vertical tab isn't whitespace",
+                 function () Filter.hex_decode("01\11 23") end)
 end
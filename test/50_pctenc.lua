@@ -79,6 +79,28 @@ function test_big ()
     end
 end
 
+function test_decode_escape_split_between_chunks ()
+    for split = 1, 4 do
+        local input = "ab%41%42cd"
+        local obj = Filter:new("percent_decode")
+        obj:add(input:sub(1, split + 2))
+        obj:add(input:sub(split + 3))
+        is("abABcd", obj:result(), "split after " .. (split + 2))
+    end
+end
+
+function test_big_all_escaped ()
+    -- Much more output than expected from the size of the input.
+    local input = ("\0\255 "):rep(20000)
+    local expected = ("%00%FF%20"):rep(20000)
+    is(expected, Filter.percent_encode(input))
+    local obj = Filter:new("percent_encode")
+    obj:add(input)
+    obj:add(input)
+    is(expected .. expected, obj:result())
+    is(input, Filter.percent_decode(expected))
+end
+
 function test_bad_hex_detected ()
     local options = {}
     assert_error("no hex digits",